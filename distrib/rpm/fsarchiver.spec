@@ -1,5 +1,5 @@
 Name:		fsarchiver
-Version:	plus-0.6.17
+Version:	plus-0.6.18
 Release:	1%{?dist}
 Summary:	Safe and flexible file-system backup/deployment tool
 
@@ -37,6 +37,12 @@ char *compalgostr(int algo)
         case COMPRESS_GZIP:    return "gzip";
         case COMPRESS_BZIP2:   return "bzip2";
         case COMPRESS_LZMA:    return "lzma";
+        case COMPRESS_ZSTD:    return "zstd";
+        case COMPRESS_LZ4:     return "lz4";
+        case COMPRESS_GZIPDICT: return "gzip+dict";
+        case COMPRESS_ZSTDDICT: return "zstd+dict";
+        case COMPRESS_LZMASOLID: return "lzma+solid";
+        case COMPRESS_ZSTDSOLID: return "zstd+solid";
         default:               return "unknown";
     }
 }
@@ -47,6 +53,7 @@ char *cryptalgostr(int algo)
     {
         case ENCRYPT_NONE:     return "none";
         case ENCRYPT_BLOWFISH: return "blowfish";
+        case ENCRYPT_AES256GCM: return "aes256-gcm";
         default:               return "unknown";
     }
 }
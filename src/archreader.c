@@ -30,9 +30,11 @@
 #include "fsarchiver.h"
 #include "dico.h"
 #include "common.h"
+#include "checksum.h"
 #include "options.h"
 #include "archreader.h"
 #include "queue.h"
+#include "blkpool.h"
 #include "comp_gzip.h"
 #include "comp_bzip2.h"
 #include "error.h"
@@ -436,12 +438,17 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
 {
     u32 arblockcsumorig;
     u32 arblockcsumcalc;
+    u16 csumalgo; // checksum algo used
     u32 curblocksize; // data size
     u64 blockoffset; // offset of the block in the file
     u16 compalgo; // compression algo used
     u16 cryptalgo; // encryption algo used
     u32 finalsize; // compressed  block size
+    u16 zeroblock=false; // the block has no data when all its bytes are zero
     u32 compsize;
+    u64 groupid=0;
+    u32 grouppos=0;
+    u64 cryptnonce=0;
     u8 *buffer;
     
     assert(ai);
@@ -483,11 +490,47 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
         return -1;
     }
     
-    if (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_ARCSUM, &arblockcsumorig)!=0)
+    // blocks have either a crc32c or a fletcher32 checksum (archives written before crc32c was introduced)
+    if (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_ARCRC32C, &arblockcsumorig)==0)
+    {   csumalgo=CSUMALGO_CRC32C;
+    }
+    else if (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_ARCSUM, &arblockcsumorig)==0)
+    {   csumalgo=CSUMALGO_FLETCHER32;
+    }
+    else
     {   msgprintf(3, "cannot get BLOCKHEADITEMKEY_ARCSUM from block-header\n");
         return -1;
     }
     
+    // the blocks of a solid group are parts of a single compressed stream (option -g)
+    if (((compalgo==COMPRESS_LZMASOLID) || (compalgo==COMPRESS_ZSTDSOLID)) && 
+        ((dico_get_u64(in_blkdico, 0, BLOCKHEADITEMKEY_GROUPID, &groupid)!=0) || (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_GROUPPOS, &grouppos)!=0)))
+    {   msgprintf(3, "cannot get BLOCKHEADITEMKEY_GROUPID from block-header\n");
+        return -1;
+    }
+    
+    if ((cryptalgo==ENCRYPT_AES256GCM) && (dico_get_u64(in_blkdico, 0, BLOCKHEADITEMKEY_CRYPTNONCE, &cryptnonce)!=0))
+    {   msgprintf(3, "cannot get BLOCKHEADITEMKEY_CRYPTNONCE from block-header\n");
+        return -1;
+    }
+    
+    if ((dico_get_u16(in_blkdico, 0, BLOCKHEADITEMKEY_ZEROBLOCK, &zeroblock)==0) && (zeroblock==true))
+    {   if (in_skipblock==true)
+            return 0;
+        // there are no data to read, to check and to uncompress: the block only has to be filled with zeros
+        if ((out_blkinfo->blkdata=blkpool_alloc(curblocksize))==NULL)
+        {   errprintf("cannot allocate block: blkpool_alloc(%d) failed\n", curblocksize);
+            return FSAERR_ENOMEM;
+        }
+        memset(out_blkinfo->blkdata, 0, curblocksize);
+        out_blkinfo->blkrealsize=curblocksize;
+        out_blkinfo->blkoffset=blockoffset;
+        out_blkinfo->blkhasdatamd5=(dico_get_data(in_blkdico, 0, BLOCKHEADITEMKEY_DATAMD5, out_blkinfo->blkdatamd5, 16, NULL)==0);
+        out_blkinfo->blkzero=true;
+        *out_sumok=true;
+        return 0;
+    }
+    
     if (in_skipblock==true) // the main thread does not need that block (block belongs to a filesys we want to skip)
     {
         if (lseek64(ai->archfd, (long)finalsize, SEEK_CUR)<0)
@@ -498,14 +541,14 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
     }
     
     // ---- allocate memory
-    if ((buffer=malloc(finalsize))==NULL)
-    {   errprintf("cannot allocate block: malloc(%d) failed\n", finalsize);
+    if ((buffer=blkpool_alloc(finalsize))==NULL)
+    {   errprintf("cannot allocate block: blkpool_alloc(%d) failed\n", finalsize);
         return FSAERR_ENOMEM;
     }
     
     if (read(ai->archfd, buffer, (long)finalsize)!=(long)finalsize)
     {   sysprintf("cannot read block (finalsize=%ld) failed\n", (long)finalsize);
-        free(buffer);
+        blkpool_free(buffer);
         return -1;
     }
     
@@ -514,22 +557,29 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
     out_blkinfo->blkrealsize=curblocksize;
     out_blkinfo->blkoffset=blockoffset;
     out_blkinfo->blkarcsum=arblockcsumorig;
+    out_blkinfo->blkarcsumalgo=csumalgo;
     out_blkinfo->blkcompalgo=compalgo;
     out_blkinfo->blkcryptalgo=cryptalgo;
+    out_blkinfo->blkcryptnonce=cryptnonce;
     out_blkinfo->blkarsize=finalsize;
     out_blkinfo->blkcompsize=compsize;
+    out_blkinfo->blkgroupid=groupid;
+    out_blkinfo->blkgrouppos=grouppos;
+    out_blkinfo->blkhasdatamd5=(dico_get_data(in_blkdico, 0, BLOCKHEADITEMKEY_DATAMD5, out_blkinfo->blkdatamd5, 16, NULL)==0);
+    out_blkinfo->blkdatacorrupt=false;
     
     // ---- checksum
-    arblockcsumcalc=fletcher32(buffer, finalsize);
+    arblockcsumcalc=checksum_block(csumalgo, buffer, finalsize);
     if (arblockcsumcalc!=arblockcsumorig) // bad checksum
     {
         errprintf("block is corrupt at offset=%ld, blksize=%ld\n", (long)blockoffset, (long)curblocksize);
-        free(out_blkinfo->blkdata);
-        if ((out_blkinfo->blkdata=malloc(curblocksize))==NULL)
-        {   errprintf("cannot allocate block: malloc(%d) failed\n", curblocksize);
+        blkpool_free(out_blkinfo->blkdata);
+        if ((out_blkinfo->blkdata=blkpool_alloc(curblocksize))==NULL)
+        {   errprintf("cannot allocate block: blkpool_alloc(%d) failed\n", curblocksize);
             return FSAERR_ENOMEM;
         }
         memset(out_blkinfo->blkdata, 0, curblocksize);
+        out_blkinfo->blkdatacorrupt=out_blkinfo->blkhasdatamd5;
         *out_sumok=false;
         // go to the beginning of the corrupted contents so that the next header is searched here
         if (lseek64(ai->archfd, -(long long)finalsize, SEEK_CUR)<0)
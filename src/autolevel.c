@@ -0,0 +1,180 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <pthread.h>
+#include <assert.h>
+
+#include "fsarchiver.h"
+#include "autolevel.h"
+#include "archinfo.h"
+#include "options.h"
+#include "syncthread.h"
+#include "queue.h"
+#include "error.h"
+
+// with "-z auto" the compression threads choose the algorithm and the level of each block from a list
+// of steps sorted from the fastest to the best one. The controller watches where the threads of the
+// queue have to wait: when the writer waits for blocks to be compressed the compression is too slow
+// and it moves one step down, and when producers wait on a queue full of compressed blocks (or the
+// compression threads have nothing to do) the output is the bottleneck and it moves one step up.
+// The algorithm is stored in the header of each block so the archive can be restored as usual.
+cautostep g_autosteps[FSA_AUTOLEVEL_MAXSTEPS];
+int g_autostepcount=0; // how many steps there are in g_autosteps
+volatile int g_autostep=0; // index of the step used for the next blocks
+u64 g_autoblocks=0; // how many blocks have been compressed
+u64 g_autocompstalls=0; // queue counters at the time the level was reconsidered the last time
+u64 g_autooutputstalls=0;
+u64 g_autoidlestalls=0;
+pthread_mutex_t g_automutex=PTHREAD_MUTEX_INITIALIZER;
+
+static void autolevel_add_step(u16 algo, int level)
+{
+    if (g_autostepcount<FSA_AUTOLEVEL_MAXSTEPS)
+    {   g_autosteps[g_autostepcount].algo=algo;
+        g_autosteps[g_autostepcount].level=level;
+        g_autostepcount++;
+    }
+}
+
+int autolevel_init()
+{
+    int i;
+    
+    g_autostepcount=0;
+    
+    // fastest step: only useful when the disks are faster than gzip
+#if defined(OPTION_LZ4_SUPPORT)
+    autolevel_add_step(COMPRESS_LZ4, 1);
+#elif defined(OPTION_LZO_SUPPORT)
+    autolevel_add_step(COMPRESS_LZO, 0);
+#endif
+    
+#ifdef OPTION_ZSTD_SUPPORT
+    autolevel_add_step(COMPRESS_ZSTD, 1);
+    autolevel_add_step(COMPRESS_ZSTD, 3);
+    autolevel_add_step(COMPRESS_ZSTD, 6);
+    autolevel_add_step(COMPRESS_ZSTD, 9);
+    autolevel_add_step(COMPRESS_ZSTD, 12);
+    autolevel_add_step(COMPRESS_ZSTD, 15);
+    autolevel_add_step(COMPRESS_ZSTD, 18);
+#else
+    autolevel_add_step(COMPRESS_GZIP, 1);
+    autolevel_add_step(COMPRESS_GZIP, 3);
+    autolevel_add_step(COMPRESS_GZIP, 6);
+    autolevel_add_step(COMPRESS_GZIP, 9);
+#ifdef OPTION_LZMA_SUPPORT
+    autolevel_add_step(COMPRESS_LZMA, 1);
+    autolevel_add_step(COMPRESS_LZMA, 6);
+#endif // OPTION_LZMA_SUPPORT
+#endif // OPTION_ZSTD_SUPPORT
+    
+    // start from the default gzip level or the zstd level which is about as fast
+    for (g_autostep=0, i=0; i<g_autostepcount; i++)
+        if (((g_autosteps[i].algo==COMPRESS_GZIP) && (g_autosteps[i].level==FSA_DEF_COMPRESS_LEVEL))
+            || ((g_autosteps[i].algo==COMPRESS_ZSTD) && (g_autosteps[i].level==3)))
+            g_autostep=i;
+    
+    g_autoblocks=0;
+    g_autocompstalls=0;
+    g_autooutputstalls=0;
+    g_autoidlestalls=0;
+    
+    return 0;
+}
+
+// algorithm and level to use for the next block
+int autolevel_get(int *algo, int *level)
+{
+    cautostep *step;
+    
+    if (!algo || !level || (g_autostepcount<1))
+    {   errprintf("invalid parameters\n");
+        return -1;
+    }
+    
+    step=&g_autosteps[g_autostep];
+    *algo=step->algo;
+    *level=step->level;
+    return 0;
+}
+
+// first and last steps: also used by the compression policies of option -t
+int autolevel_get_fastest(int *algo, int *level)
+{
+    if (!algo || !level || (g_autostepcount<1))
+    {   errprintf("invalid parameters\n");
+        return -1;
+    }
+    
+    *algo=g_autosteps[0].algo;
+    *level=g_autosteps[0].level;
+    return 0;
+}
+
+int autolevel_get_strongest(int *algo, int *level)
+{
+    if (!algo || !level || (g_autostepcount<1))
+    {   errprintf("invalid parameters\n");
+        return -1;
+    }
+    
+    *algo=g_autosteps[g_autostepcount-1].algo;
+    *level=g_autosteps[g_autostepcount-1].level;
+    return 0;
+}
+
+// called by the compression threads after each block: only one of them reconsiders the level
+int autolevel_update()
+{
+    u64 compstalls, outputstalls, idlestalls;
+    u64 slow, fast;
+    int oldstep;
+    
+    if ((__sync_add_and_fetch(&g_autoblocks, 1) % FSA_AUTOLEVEL_WINDOW)!=0)
+        return 0;
+    
+    if (pthread_mutex_trylock(&g_automutex)!=0)
+        return 0; // another thread is doing it
+    
+    if (queue_get_stalls(&g_queue, &compstalls, &outputstalls, &idlestalls)!=0)
+    {   assert(pthread_mutex_unlock(&g_automutex)==0);
+        return -1;
+    }
+    
+    slow=compstalls-g_autocompstalls; // the writer waited for the compression
+    fast=(outputstalls-g_autooutputstalls)+(idlestalls-g_autoidlestalls); // the compression waited for the others
+    g_autocompstalls=compstalls;
+    g_autooutputstalls=outputstalls;
+    g_autoidlestalls=idlestalls;
+    
+    oldstep=g_autostep;
+    if ((slow>fast) && (g_autostep>0))
+        g_autostep--;
+    else if ((slow==0) && (fast>0) && (g_autostep<g_autostepcount-1))
+        g_autostep++;
+    
+    if (g_autostep!=oldstep)
+        msgprintf(MSG_VERB2, "automatic compression: switching to %s level %d (stalls: compression=%ld, other=%ld)\n", 
+            compalgostr(g_autosteps[g_autostep].algo), g_autosteps[g_autostep].level, (long)slow, (long)fast);
+    
+    assert(pthread_mutex_unlock(&g_automutex)==0);
+    return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __AUTOLEVEL_H__
+#define __AUTOLEVEL_H__
+
+#define FSA_AUTOLEVEL_WINDOW     16             // the level is reconsidered every time that many blocks have been compressed
+#define FSA_AUTOLEVEL_MAXSTEPS   16
+
+struct s_autostep;
+typedef struct s_autostep cautostep;
+
+struct s_autostep // one of the compression algorithms and levels the controller can choose from
+{   u16      algo; // COMPRESS_xxx
+    int      level; // level passed to the compression function
+};
+
+int autolevel_init();
+int autolevel_get(int *algo, int *level);
+int autolevel_get_fastest(int *algo, int *level);
+int autolevel_get_strongest(int *algo, int *level);
+int autolevel_update();
+
+#endif // __AUTOLEVEL_H__
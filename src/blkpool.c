@@ -0,0 +1,174 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "fsarchiver.h"
+#include "blkpool.h"
+#include "error.h"
+
+// the data blocks are allocated and released thousands of times per second in the save/compress/write
+// and read/decompress/restore threads: the pool keeps the buffers which are released so that they can
+// be used again instead of calling malloc/free and faulting new pages every time
+cblkpoolclass g_blkpool[BLKPOOL_MAXCLASSES];
+int g_blkpoolclasses=0; // how many classes there are in g_blkpool
+u64 g_blkpoolmem=0; // bytes currently allocated for the buffers of the pool (in use or free)
+u64 g_blkpoolmax=0; // buffers are released using free() when g_blkpoolmem is above that limit
+
+int blkpool_init()
+{
+    u64 size, step;
+    int i;
+    
+    // class sizes: 4096, 5120, 6144, 7168, 8192, 10240, ... 917504, 1048576
+    g_blkpoolclasses=0;
+    for (size=BLKPOOL_MINSIZE; size<=BLKPOOL_MAXSIZE; size+=step)
+    {
+        for (step=1; step*BLKPOOL_SUBCLASSES*2<=size; step<<=1);
+        g_blkpool[g_blkpoolclasses].size=size;
+        g_blkpool[g_blkpoolclasses].first=NULL;
+        g_blkpoolclasses++;
+    }
+    
+    for (i=0; i<g_blkpoolclasses; i++)
+    {
+        if (pthread_mutex_init(&g_blkpool[i].mutex, NULL)!=0)
+        {   errprintf("pthread_mutex_init() failed\n");
+            return -1;
+        }
+    }
+    
+    g_blkpoolmem=0;
+    g_blkpoolmax=FSA_DEF_MAXMEMORY;
+    
+    return 0;
+}
+
+int blkpool_destroy()
+{
+    cblkpoolhead *head;
+    int i;
+    
+    for (i=0; i<g_blkpoolclasses; i++)
+    {
+        while ((head=g_blkpool[i].first)!=NULL)
+        {
+            g_blkpool[i].first=head->next;
+            free(head);
+        }
+        assert(pthread_mutex_destroy(&g_blkpool[i].mutex)==0);
+    }
+    g_blkpoolclasses=0;
+    
+    return 0;
+}
+
+// buffers in use and free buffers kept in the pool should not use more memory than the queue budget
+void blkpool_set_max_memory(u64 maxmem)
+{
+    g_blkpoolmax=maxmem;
+}
+
+// returns the smallest class which can store size bytes or -1 if the buffer is too big for the pool
+int blkpool_get_classid(u64 size)
+{
+    int first=0;
+    int last=g_blkpoolclasses-1;
+    int mid;
+    
+    if (size>BLKPOOL_MAXSIZE)
+        return -1;
+    
+    while (first<last)
+    {
+        mid=(first+last)/2;
+        if (g_blkpool[mid].size<size)
+            first=mid+1;
+        else
+            last=mid;
+    }
+    
+    return first;
+}
+
+void *blkpool_alloc(u64 size)
+{
+    cblkpoolhead *head=NULL;
+    cblkpoolclass *class=NULL;
+    u64 allocsize;
+    int classid;
+    
+    if ((classid=blkpool_get_classid(size))>=0)
+    {
+        class=&g_blkpool[classid];
+        assert(pthread_mutex_lock(&class->mutex)==0);
+        if ((head=class->first)!=NULL)
+            class->first=head->next;
+        assert(pthread_mutex_unlock(&class->mutex)==0);
+        if (head!=NULL)
+            return (void*)(head+1);
+        allocsize=class->size;
+    }
+    else
+    {
+        allocsize=size;
+    }
+    
+    if ((head=malloc(sizeof(cblkpoolhead)+allocsize))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)(sizeof(cblkpoolhead)+allocsize));
+        return NULL;
+    }
+    head->next=NULL;
+    head->classid=classid;
+    if (classid>=0)
+        __sync_add_and_fetch(&g_blkpoolmem, allocsize);
+    
+    return (void*)(head+1);
+}
+
+void blkpool_free(void *buffer)
+{
+    cblkpoolhead *head;
+    cblkpoolclass *class;
+    
+    if (buffer==NULL)
+        return;
+    
+    head=((cblkpoolhead*)buffer)-1;
+    if (head->classid<0)
+    {   free(head);
+        return;
+    }
+    
+    // give the memory back to the system if the pool has more than its budget
+    class=&g_blkpool[head->classid];
+    if (__sync_add_and_fetch(&g_blkpoolmem, 0) > g_blkpoolmax)
+    {   __sync_sub_and_fetch(&g_blkpoolmem, class->size);
+        free(head);
+        return;
+    }
+    
+    assert(pthread_mutex_lock(&class->mutex)==0);
+    head->next=class->first;
+    class->first=head;
+    assert(pthread_mutex_unlock(&class->mutex)==0);
+}
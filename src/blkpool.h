@@ -0,0 +1,54 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __BLKPOOL_H__
+#define __BLKPOOL_H__
+
+#include <pthread.h>
+
+#define BLKPOOL_MINSIZE          4096           // smallest buffer size managed by the pool
+#define BLKPOOL_MAXSIZE          1048576        // bigger buffers are allocated and released using malloc/free
+#define BLKPOOL_SUBCLASSES       4              // there are four sizes of buffers between two powers of two
+#define BLKPOOL_MAXCLASSES       64
+
+struct s_blkpoolhead;
+typedef struct s_blkpoolhead cblkpoolhead;
+
+struct s_blkpoolclass;
+typedef struct s_blkpoolclass cblkpoolclass;
+
+struct s_blkpoolhead // stored in front of each buffer (the size is a multiple of 16 to keep the data aligned)
+{   cblkpoolhead         *next; // next free buffer of the same class (only used while the buffer is in the pool)
+    s32                  classid; // index of the class of the buffer, or -1 if it's not managed by the pool
+} __attribute__((aligned(16)));
+
+struct s_blkpoolclass // all the free buffers which have a particular size
+{   pthread_mutex_t      mutex; // each class has its own mutex to reduce contention between threads
+    u64                  size; // size of the buffers of this class (without the header)
+    cblkpoolhead         *first; // list of the free buffers
+};
+
+// init and destroy
+int  blkpool_init();
+int  blkpool_destroy();
+void blkpool_set_max_memory(u64 maxmem);
+
+// get and give back a buffer for a data block (buffers are handed between threads with the blocks)
+void *blkpool_alloc(u64 size);
+void blkpool_free(void *buffer);
+
+#endif // __BLKPOOL_H__
@@ -0,0 +1,324 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+
+#include "fsarchiver.h"
+#include "checksum.h"
+
+// the x86 kernels are compiled with the target attribute so that the program still runs on any cpu
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#  define FSA_CHECKSUM_X86
+#  include <immintrin.h>
+#endif
+
+typedef u32 (*cchecksumfct)(u8 *data, u32 len);
+
+static u32 fletcher32_generic(u8 *data, u32 len);
+static u32 crc32c_generic(u8 *data, u32 len);
+
+// implementations selected by checksum_init() for the cpu the program runs on
+static cchecksumfct g_fletcher32=fletcher32_generic;
+static cchecksumfct g_crc32c=crc32c_generic;
+
+// g_crc32ctable[k][b] is the crc of byte b followed by k zero bytes (slicing-by-8)
+static u32 g_crc32ctable[8][256];
+
+// g_crc32cx2n[k] is x^(2^k) modulo the polynomial: used to combine the crc of consecutive buffers
+static u32 g_crc32cx2n[32];
+
+static u32 fletcher32_generic(u8 *data, u32 len)
+{
+    u32 sum1 = 0xffff, sum2 = 0xffff;
+    
+    while (len)
+    {
+        unsigned tlen = len > FSA_FLETCHER_CHUNK ? FSA_FLETCHER_CHUNK : len;
+        len -= tlen;
+        do {
+            sum1 += *data++;
+            sum2 += sum1;
+        } while (--tlen);
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+    // Second reduction step to reduce sums to 16 bits
+    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    return sum2 << 16 | sum1;
+}
+
+// multiply a and b modulo the crc32c polynomial (bit 31 is x^0 since the crc is reflected)
+static u32 crc32c_multmodp(u32 a, u32 b)
+{
+    u32 m=(u32)1<<31;
+    u32 p=0;
+    
+    for (;;)
+    {   if (a & m)
+        {   p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ FSA_CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+// crc of the concatenation of a first buffer (crc1) and of a second buffer of len2 bytes (crc2)
+static u32 crc32c_combine(u32 crc1, u32 crc2, u64 len2)
+{
+    u32 p=(u32)1<<31; // x^0
+    int k=3; // x^(8*len2)
+    
+    for (; len2; len2>>=1, k++)
+        if (len2 & 1)
+            p=crc32c_multmodp(g_crc32cx2n[k & 31], p);
+    return crc32c_multmodp(p, crc1) ^ crc2;
+}
+
+static void crc32c_init_tables()
+{
+    u32 crc;
+    int b, k;
+    
+    for (b=0; b<256; b++)
+    {   crc=b;
+        for (k=0; k<8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ FSA_CRC32C_POLY : crc >> 1;
+        g_crc32ctable[0][b]=crc;
+    }
+    for (b=0; b<256; b++)
+        for (k=1; k<8; k++)
+            g_crc32ctable[k][b]=(g_crc32ctable[k-1][b] >> 8) ^ g_crc32ctable[0][g_crc32ctable[k-1][b] & 0xff];
+    
+    g_crc32cx2n[0]=(u32)1<<30; // x^1
+    for (k=1; k<32; k++)
+        g_crc32cx2n[k]=crc32c_multmodp(g_crc32cx2n[k-1], g_crc32cx2n[k-1]);
+}
+
+static u32 crc32c_generic(u8 *data, u32 len)
+{
+    u32 crc=0xffffffff;
+    u32 lo, hi;
+    
+    for (; len && ((unsigned long)data & 7); len--)
+        crc = (crc >> 8) ^ g_crc32ctable[0][(crc ^ *data++) & 0xff];
+    for (; len >= 8; len -= 8, data += 8)
+    {   memcpy(&lo, data, 4);
+        memcpy(&hi, data+4, 4);
+        lo = le32_to_cpu(lo) ^ crc;
+        hi = le32_to_cpu(hi);
+        crc = g_crc32ctable[7][lo & 0xff] ^ g_crc32ctable[6][(lo >> 8) & 0xff] ^
+              g_crc32ctable[5][(lo >> 16) & 0xff] ^ g_crc32ctable[4][lo >> 24] ^
+              g_crc32ctable[3][hi & 0xff] ^ g_crc32ctable[2][(hi >> 8) & 0xff] ^
+              g_crc32ctable[1][(hi >> 16) & 0xff] ^ g_crc32ctable[0][hi >> 24];
+    }
+    for (; len; len--)
+        crc = (crc >> 8) ^ g_crc32ctable[0][(crc ^ *data++) & 0xff];
+    return ~crc;
+}
+
+#ifdef FSA_CHECKSUM_X86
+
+// The vector kernels compute the exact sums of each chunk and reduce them at the same places as the
+// generic code, so the result is the same. For the n bytes b[0..n-1] of a chunk:
+//   sum1 += b[0] + ... + b[n-1]
+//   sum2 += n*sum1 + n*b[0] + (n-1)*b[1] + ... + 1*b[n-1]
+// Each vector of bytes v[j] is multiplied by the weights (width..1) and the term width*(k-1-j)*sum(v[j])
+// is obtained by adding the sums of the previous vectors once per vector (vprev).
+
+__attribute__((target("sse4.1")))
+static u32 fletcher32_sse41(u8 *data, u32 len)
+{
+    const __m128i weights=_mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i ones=_mm_set1_epi16(1);
+    const __m128i zero=_mm_setzero_si128();
+    __m128i vsum, vprev, vweighted, v;
+    u32 sum1 = 0xffff, sum2 = 0xffff;
+    u32 tlen, count, i;
+    
+    while (len)
+    {
+        tlen = len > FSA_FLETCHER_CHUNK ? FSA_FLETCHER_CHUNK : len;
+        len -= tlen;
+        if ((count=tlen/16)>0)
+        {
+            vsum=zero;
+            vprev=zero;
+            vweighted=zero;
+            for (i=0; i<count; i++, data+=16)
+            {   v=_mm_loadu_si128((__m128i*)data);
+                vprev=_mm_add_epi32(vprev, vsum);
+                vsum=_mm_add_epi32(vsum, _mm_sad_epu8(v, zero));
+                vweighted=_mm_add_epi32(vweighted, _mm_madd_epi16(_mm_maddubs_epi16(v, weights), ones));
+            }
+            vweighted=_mm_add_epi32(vweighted, _mm_slli_epi32(vprev, 4));
+            vweighted=_mm_add_epi32(vweighted, _mm_shuffle_epi32(vweighted, _MM_SHUFFLE(1, 0, 3, 2)));
+            vweighted=_mm_add_epi32(vweighted, _mm_shuffle_epi32(vweighted, _MM_SHUFFLE(2, 3, 0, 1)));
+            sum2 += count*16*sum1 + (u32)_mm_cvtsi128_si32(vweighted);
+            sum1 += (u32)_mm_cvtsi128_si32(vsum) + (u32)_mm_extract_epi32(vsum, 2);
+            tlen -= count*16;
+        }
+        while (tlen--)
+        {   sum1 += *data++;
+            sum2 += sum1;
+        }
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    return sum2 << 16 | sum1;
+}
+
+__attribute__((target("avx2")))
+static u32 fletcher32_avx2(u8 *data, u32 len)
+{
+    const __m256i weights=_mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i ones=_mm256_set1_epi16(1);
+    const __m256i zero=_mm256_setzero_si256();
+    __m256i vsum, vprev, vweighted, v;
+    __m128i hsum, hweighted;
+    u32 sum1 = 0xffff, sum2 = 0xffff;
+    u32 tlen, count, i;
+    
+    while (len)
+    {
+        tlen = len > FSA_FLETCHER_CHUNK ? FSA_FLETCHER_CHUNK : len;
+        len -= tlen;
+        if ((count=tlen/32)>0)
+        {
+            vsum=zero;
+            vprev=zero;
+            vweighted=zero;
+            for (i=0; i<count; i++, data+=32)
+            {   v=_mm256_loadu_si256((__m256i*)data);
+                vprev=_mm256_add_epi32(vprev, vsum);
+                vsum=_mm256_add_epi32(vsum, _mm256_sad_epu8(v, zero));
+                vweighted=_mm256_add_epi32(vweighted, _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+            }
+            vweighted=_mm256_add_epi32(vweighted, _mm256_slli_epi32(vprev, 5));
+            hweighted=_mm_add_epi32(_mm256_castsi256_si128(vweighted), _mm256_extracti128_si256(vweighted, 1));
+            hweighted=_mm_add_epi32(hweighted, _mm_shuffle_epi32(hweighted, _MM_SHUFFLE(1, 0, 3, 2)));
+            hweighted=_mm_add_epi32(hweighted, _mm_shuffle_epi32(hweighted, _MM_SHUFFLE(2, 3, 0, 1)));
+            hsum=_mm_add_epi32(_mm256_castsi256_si128(vsum), _mm256_extracti128_si256(vsum, 1));
+            sum2 += count*32*sum1 + (u32)_mm_cvtsi128_si32(hweighted);
+            sum1 += (u32)_mm_cvtsi128_si32(hsum) + (u32)_mm_extract_epi32(hsum, 2);
+            tlen -= count*32;
+        }
+        while (tlen--)
+        {   sum1 += *data++;
+            sum2 += sum1;
+        }
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    return sum2 << 16 | sum1;
+}
+
+#ifdef __x86_64__
+
+// the crc32 instruction has a latency of three cycles but a throughput of one per cycle: large buffers
+// are split in three parts which are processed at the same time and the three crcs are combined
+__attribute__((target("sse4.2")))
+static u32 crc32c_sse42(u8 *data, u32 len)
+{
+    u64 crc0=0xffffffff, crc1=0xffffffff, crc2=0xffffffff;
+    u64 v0, v1, v2;
+    u32 part, i;
+    u32 crc;
+    
+    if (len >= 3*FSA_CRC32C_MINSPLIT)
+    {
+        part=(len/3) & ~7;
+        for (i=0; i<part; i+=8)
+        {   memcpy(&v0, data+i, 8);
+            memcpy(&v1, data+part+i, 8);
+            memcpy(&v2, data+2*part+i, 8);
+            crc0=_mm_crc32_u64(crc0, v0);
+            crc1=_mm_crc32_u64(crc1, v1);
+            crc2=_mm_crc32_u64(crc2, v2);
+        }
+        crc=crc32c_combine(~(u32)crc0, ~(u32)crc1, part);
+        crc=crc32c_combine(crc, ~(u32)crc2, part);
+        data+=3*part;
+        len-=3*part;
+        if (len==0)
+            return crc;
+        return crc32c_combine(crc, crc32c_sse42(data, len), len);
+    }
+    
+    for (; len >= 8; len -= 8, data += 8)
+    {   memcpy(&v0, data, 8);
+        crc0=_mm_crc32_u64(crc0, v0);
+    }
+    crc=(u32)crc0;
+    for (; len; len--)
+        crc=_mm_crc32_u8(crc, *data++);
+    return ~crc;
+}
+
+#endif // __x86_64__
+
+#endif // FSA_CHECKSUM_X86
+
+int checksum_init()
+{
+    crc32c_init_tables();
+    
+#ifdef FSA_CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        g_fletcher32=fletcher32_avx2;
+    else if (__builtin_cpu_supports("sse4.1"))
+        g_fletcher32=fletcher32_sse41;
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("sse4.2"))
+        g_crc32c=crc32c_sse42;
+#endif // __x86_64__
+#endif // FSA_CHECKSUM_X86
+    return 0;
+}
+
+u32 fletcher32(u8 *data, u32 len)
+{
+    return g_fletcher32(data, len);
+}
+
+u32 crc32c(u8 *data, u32 len)
+{
+    return g_crc32c(data, len);
+}
+
+// checksum of a block as it is in the archive (CSUMALGO_xxx)
+u32 checksum_block(int algo, u8 *data, u32 len)
+{
+    switch (algo)
+    {
+        case CSUMALGO_CRC32C:    return crc32c(data, len);
+        default:                 return fletcher32(data, len);
+    }
+}
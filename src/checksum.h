@@ -0,0 +1,32 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include "types.h"
+
+#define FSA_FLETCHER_CHUNK       360            // bytes summed before the sums are reduced (sum2 cannot overflow)
+#define FSA_CRC32C_POLY          0x82F63B78     // castagnoli polynomial (reversed) used by the sse4.2 instruction
+#define FSA_CRC32C_MINSPLIT      4096           // smaller buffers are not split into three interleaved streams
+
+int checksum_init();
+u32 fletcher32(u8 *data, u32 len);
+u32 crc32c(u8 *data, u32 len);
+u32 checksum_block(int algo, u8 *data, u32 len);
+
+#endif // __CHECKSUM_H__
@@ -217,27 +217,6 @@ u32 generate_random_u32_id(void)
     return archid;
 }
 
-u32 fletcher32(u8 *data, u32 len)
-{
-    u32 sum1 = 0xffff, sum2 = 0xffff;
-    
-    while (len)
-    {
-        unsigned tlen = len > 360 ? 360 : len;
-        len -= tlen;
-        do {
-            sum1 += *data++;
-            sum2 += sum1;
-        } while (--tlen);
-        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
-        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
-    }
-    // Second reduction step to reduce sums to 16 bits
-    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
-    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
-    return sum2 << 16 | sum1;
-}
-
 int regfile_exists(char *filepath)
 {
     struct stat64 st;
@@ -41,7 +41,6 @@ int mkdir_recursive(char *path);
 char *get_objtype_name(int objtype);
 int is_dir_empty(char *path);
 u32 generate_random_u32_id(void);
-u32 fletcher32(u8 *data, u32 len);
 int regfile_exists(char *filepath);
 int is_magic_valid(char *magic);
 char *strlcatf(char *dest, int destbufsize, char *format, ...) __attribute__ ((format (printf, 3, 4)));
@@ -19,50 +19,125 @@
 #  include "config.h"
 #endif
 
+#include <string.h>
 #include <zlib.h>
 
 #include "fsarchiver.h"
 #include "common.h"
 #include "comp_gzip.h"
+#include "compdict.h"
 #include "error.h"
 
-int compress_block_gzip(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
+int comp_gzip_ctx_init(cgzipctx *ctx)
 {
-    uLong gzsize;
-    Bytef *gzbuffer;
+    memset(ctx, 0, sizeof(cgzipctx));
+    ctx->deflatelevel=-1;
+    ctx->inflateok=false;
+    return 0;
+}
+
+int comp_gzip_ctx_destroy(cgzipctx *ctx)
+{
+    if (ctx->deflatelevel>=0)
+        deflateEnd(&ctx->deflate);
+    if (ctx->inflateok==true)
+        inflateEnd(&ctx->inflate);
+    return comp_gzip_ctx_init(ctx);
+}
+
+// same output as compress2() but the deflate state is only allocated again when the level changes
+// (the last 32KB of dict are used as a preset dictionary when it's not NULL)
+int compress_block_gzip(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, u8 *dict, u32 dictsize, cgzipctx *ctx)
+{
+    z_stream *strm=&ctx->deflate;
+    int res;
+    
+    if (ctx->deflatelevel!=level)
+    {
+        if (ctx->deflatelevel>=0)
+            deflateEnd(strm);
+        ctx->deflatelevel=-1;
+        memset(strm, 0, sizeof(z_stream));
+        switch (deflateInit(strm, level))
+        {
+            case Z_OK:
+                ctx->deflatelevel=level;
+                break;
+            case Z_MEM_ERROR:
+                return FSAERR_ENOMEM;
+            default:
+                return FSAERR_UNKNOWN;
+        }
+    }
+    else if (deflateReset(strm)!=Z_OK)
+    {   errprintf("deflateReset() failed\n");
+        return FSAERR_UNKNOWN;
+    }
     
-    gzsize=(uLong)compbufsize;
-    gzbuffer=(Bytef *)compbuf;
+    if ((dict!=NULL) && (deflateSetDictionary(strm, dict+dictsize-min(dictsize, FSA_DICT_GZIPSIZE), min(dictsize, FSA_DICT_GZIPSIZE))!=Z_OK))
+    {   errprintf("deflateSetDictionary() failed\n");
+        return FSAERR_UNKNOWN;
+    }
     
-    switch (compress2(gzbuffer, &gzsize, (const Bytef*)origbuf, (uLong)origsize, level))
+    strm->next_in=(Bytef*)origbuf;
+    strm->avail_in=(uInt)origsize;
+    strm->next_out=(Bytef*)compbuf;
+    strm->avail_out=(uInt)compbufsize;
+    
+    switch ((res=deflate(strm, Z_FINISH)))
     {
-        case Z_OK:
-            *compsize=(u64)gzsize;
+        case Z_STREAM_END:
+            *compsize=(u64)strm->total_out;
             return FSAERR_SUCCESS;
         case Z_MEM_ERROR:
             return FSAERR_ENOMEM;
-        default:
+        default: // Z_OK or Z_BUF_ERROR mean that the output buffer is too small
             return FSAERR_UNKNOWN;
     }
-    
-    return FSAERR_UNKNOWN;
 }
 
-int uncompress_block_gzip(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+int uncompress_block_gzip(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, u8 *dict, u32 dictsize, cgzipctx *ctx)
 {
-    uLong gzsize=(uLong)origbufsize;
-    Bytef *gzbuffer=(Bytef *)origbuf;
+    z_stream *strm=&ctx->inflate;
     int res;
     
-    switch ((res=uncompress(gzbuffer, &gzsize, (const Bytef*)compbuf, (uLong)compsize)))
+    if (ctx->inflateok==false)
+    {
+        memset(strm, 0, sizeof(z_stream));
+        if ((res=inflateInit(strm))!=Z_OK)
+        {   errprintf("inflateInit() failed, res=%d\n", res);
+            return (res==Z_MEM_ERROR)?FSAERR_ENOMEM:FSAERR_UNKNOWN;
+        }
+        ctx->inflateok=true;
+    }
+    else if (inflateReset(strm)!=Z_OK)
+    {   errprintf("inflateReset() failed\n");
+        return FSAERR_UNKNOWN;
+    }
+    
+    strm->next_in=(Bytef*)compbuf;
+    strm->avail_in=(uInt)compsize;
+    strm->next_out=(Bytef*)origbuf;
+    strm->avail_out=(uInt)origbufsize;
+    
+    // the stream says when it needs the dictionary
+    if (((res=inflate(strm, Z_FINISH))==Z_NEED_DICT) && (dict!=NULL))
+    {   if (inflateSetDictionary(strm, dict+dictsize-min(dictsize, FSA_DICT_GZIPSIZE), min(dictsize, FSA_DICT_GZIPSIZE))!=Z_OK)
+        {   errprintf("inflateSetDictionary() failed\n");
+            return FSAERR_UNKNOWN;
+        }
+        res=inflate(strm, Z_FINISH);
+    }
+    
+    switch (res)
     {
-        case Z_OK:
-            *origsize=(u64)gzsize;
+        case Z_STREAM_END:
+            *origsize=(u64)strm->total_out;
             return FSAERR_SUCCESS;
         case Z_MEM_ERROR:
             return FSAERR_ENOMEM;
         default:
-            errprintf("uncompress() failed, res=%d\n", res);
+            errprintf("inflate() failed, res=%d\n", res);
             return FSAERR_UNKNOWN;
     }
 }
@@ -18,7 +18,21 @@
 #ifndef __COMPRESS_GZIP_H__
 #define __COMPRESS_GZIP_H__
 
-int compress_block_gzip(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
-int uncompress_block_gzip(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+#include <zlib.h>
+
+struct s_gzipctx;
+typedef struct s_gzipctx cgzipctx;
+
+struct s_gzipctx // zlib streams which are reset for each block instead of being allocated again
+{   z_stream  deflate; // stream used to compress blocks
+    int       deflatelevel; // level of the deflate stream or -1 if it has not been initialized
+    z_stream  inflate; // stream used to uncompress blocks
+    bool      inflateok; // true when the inflate stream has been initialized
+};
+
+int comp_gzip_ctx_init(cgzipctx *ctx);
+int comp_gzip_ctx_destroy(cgzipctx *ctx);
+int compress_block_gzip(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, u8 *dict, u32 dictsize, cgzipctx *ctx);
+int uncompress_block_gzip(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, u8 *dict, u32 dictsize, cgzipctx *ctx);
 
 #endif // __COMPRESS_GZIP_H__
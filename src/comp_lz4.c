@@ -0,0 +1,81 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include "fsarchiver.h"
+#include "comp_lz4.h"
+#include "error.h"
+
+#ifdef OPTION_LZ4_SUPPORT
+
+int comp_lz4_ctx_init(clz4ctx *ctx)
+{
+    ctx->state=NULL;
+    ctx->statehc=NULL;
+    return 0;
+}
+
+int comp_lz4_ctx_destroy(clz4ctx *ctx)
+{
+    free(ctx->state);
+    free(ctx->statehc);
+    return comp_lz4_ctx_init(ctx);
+}
+
+int compress_block_lz4(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, clz4ctx *ctx)
+{
+    int res;
+    
+    if (level<FSA_LZ4_HCLEVEL)
+    {
+        if ((ctx->state==NULL) && ((ctx->state=malloc(LZ4_sizeofState()))==NULL))
+            return FSAERR_ENOMEM;
+        res=LZ4_compress_fast_extState(ctx->state, (const char*)origbuf, (char*)compbuf, (int)origsize, (int)compbufsize, 1);
+    }
+    else
+    {
+        if ((ctx->statehc==NULL) && ((ctx->statehc=malloc(LZ4_sizeofStateHC()))==NULL))
+            return FSAERR_ENOMEM;
+        res=LZ4_compress_HC_extStateHC(ctx->statehc, (const char*)origbuf, (char*)compbuf, (int)origsize, (int)compbufsize, level);
+    }
+    
+    if (res<=0) // the compressed block does not fit in compbuf: the data is not compressible
+        return FSAERR_UNKNOWN;
+    
+    *compsize=(u64)res;
+    return FSAERR_SUCCESS;
+}
+
+int uncompress_block_lz4(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+{
+    int res;
+    
+    if ((res=LZ4_decompress_safe((const char*)compbuf, (char*)origbuf, (int)compsize, (int)origbufsize))<0)
+    {   errprintf("LZ4_decompress_safe() failed, res=%d\n", res);
+        return FSAERR_UNKNOWN;
+    }
+    
+    *origsize=(u64)res;
+    return FSAERR_SUCCESS;
+}
+
+#endif // OPTION_LZ4_SUPPORT
@@ -0,0 +1,45 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __COMPRESS_LZ4_H__
+#define __COMPRESS_LZ4_H__
+
+#define FSA_LZ4_MINLEVEL         1
+#define FSA_LZ4_MAXLEVEL         12
+#define FSA_LZ4_HCLEVEL          3              // lz4-hc is used from this level (lz4 fast below)
+
+#ifdef OPTION_LZ4_SUPPORT
+
+#include <lz4.h>
+#include <lz4hc.h>
+
+struct s_lz4ctx;
+typedef struct s_lz4ctx clz4ctx;
+
+struct s_lz4ctx // lz4 states which are reused for all the blocks processed by a thread
+{   void        *state; // LZ4_sizeofState() bytes for the fast compressor
+    void        *statehc; // LZ4_sizeofStateHC() bytes for the high compression levels
+};
+
+int comp_lz4_ctx_init(clz4ctx *ctx);
+int comp_lz4_ctx_destroy(clz4ctx *ctx);
+int compress_block_lz4(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, clz4ctx *ctx);
+int uncompress_block_lz4(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+
+#endif // OPTION_LZ4_SUPPORT
+
+#endif // __COMPRESS_LZ4_H__
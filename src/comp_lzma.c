@@ -26,102 +26,200 @@
 
 #ifdef OPTION_LZMA_SUPPORT
 
-#include <lzma.h>
+int comp_lzma_ctx_init(clzmactx *ctx)
+{
+    lzma_stream init = LZMA_STREAM_INIT;
+    
+    ctx->encoder=init;
+    ctx->decoder=init;
+    ctx->solidencoder=init;
+    ctx->soliddecoder=init;
+    ctx->memlimit=96*1024*1024;
+    return 0;
+}
 
-int compress_block_lzma(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
+int comp_lzma_ctx_destroy(clzmactx *ctx)
 {
-    lzma_stream lzma = LZMA_STREAM_INIT;
-    int res;
+    lzma_end(&ctx->encoder);
+    lzma_end(&ctx->decoder);
+    lzma_end(&ctx->solidencoder);
+    lzma_end(&ctx->soliddecoder);
+    return comp_lzma_ctx_init(ctx);
+}
+
+// called after an error: the next block will allocate a new coder
+void comp_lzma_ctx_reset_stream(lzma_stream *lzma)
+{
+    lzma_stream init = LZMA_STREAM_INIT;
     
-    // init lzma structures
-    lzma.next_in = origbuf;
-    lzma.avail_in = origsize;
-    lzma.next_out = compbuf;
-    lzma.avail_out = compbufsize;
+    lzma_end(lzma);
+    *lzma=init;
+}
+
+int compress_block_lzma(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, clzmactx *ctx)
+{
+    lzma_stream *lzma=&ctx->encoder;
+    int res;
     
-    // Initialize a coder to the lzma_stream
-    if ((res=lzma_easy_encoder(&lzma, level, LZMA_CHECK_CRC32))!=LZMA_OK)
+    // Initialize a coder to the lzma_stream: the memory of the previous coder is reused when the settings are the same
+    if ((res=lzma_easy_encoder(lzma, level, LZMA_CHECK_CRC32))!=LZMA_OK)
     {   switch (res)
         {
             case LZMA_MEM_ERROR:
                 errprintf("lzma_easy_encoder(%d): LZMA compression failed "
                     "with an out of memory error.\nYou should use a lower "
                     "compression level to reduce the memory requirement.\n", level);
-                lzma_end(&lzma);
+                comp_lzma_ctx_reset_stream(lzma);
                 return FSAERR_ENOMEM;
             default:
                 errprintf("lzma_easy_encoder(%d) failed with res=%d\n", level, res);
-                lzma_end(&lzma);
+                comp_lzma_ctx_reset_stream(lzma);
                 return FSAERR_UNKNOWN;
         }
     }
     
-    if ((res=lzma_code(&lzma, LZMA_RUN))!=LZMA_OK)
+    // init lzma structures
+    lzma->next_in = origbuf;
+    lzma->avail_in = origsize;
+    lzma->next_out = compbuf;
+    lzma->avail_out = compbufsize;
+    
+    if ((res=lzma_code(lzma, LZMA_RUN))!=LZMA_OK)
     {   errprintf("lzma_code(LZMA_RUN) failed with res=%d\n", res);
-        lzma_end(&lzma);
+        comp_lzma_ctx_reset_stream(lzma);
         return FSAERR_UNKNOWN;
     }
     
-    if ((res=lzma_code(&lzma, LZMA_FINISH))!=LZMA_STREAM_END && res!=LZMA_OK)
+    if ((res=lzma_code(lzma, LZMA_FINISH))!=LZMA_STREAM_END && res!=LZMA_OK)
     {   errprintf("lzma_code(LZMA_FINISH) failed with res=%d\n", res);
-        lzma_end(&lzma);
+        comp_lzma_ctx_reset_stream(lzma);
         return FSAERR_UNKNOWN;
     }
     
-    *compsize=(u64)(lzma.total_out);
-    lzma_end(&lzma);
+    *compsize=(u64)(lzma->total_out);
     return FSAERR_SUCCESS;
 }
 
-int uncompress_block_lzma(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+int uncompress_block_lzma(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, clzmactx *ctx)
 {
-    lzma_stream lzma = LZMA_STREAM_INIT;
+    lzma_stream *lzma=&ctx->decoder;
     u64 maxmemlimit=3ULL*1024ULL*1024ULL*1024ULL;
-    u64 memlimit=96*1024*1024;
     int res;
     
-    // init lzma structures
-    lzma.next_in = compbuf;
-    lzma.avail_in = compsize;
-    lzma.next_out = origbuf;
-    lzma.avail_out = origbufsize;
-    
-    // Initialize a coder to the lzma_stream
-    if ((res=lzma_auto_decoder(&lzma, memlimit, 0))!=LZMA_OK)
+    // Initialize a coder to the lzma_stream (with the memory limit which was needed by the previous blocks)
+    if ((res=lzma_auto_decoder(lzma, ctx->memlimit, 0))!=LZMA_OK)
     {   errprintf("lzma_auto_decoder() failed with res=%d\n", res);
-        lzma_end(&lzma);
+        comp_lzma_ctx_reset_stream(lzma);
         return FSAERR_UNKNOWN;
     }
     
+    // init lzma structures
+    lzma->next_in = compbuf;
+    lzma->avail_in = compsize;
+    lzma->next_out = origbuf;
+    lzma->avail_out = origbufsize;
+    
     do // retry if lzma_code() returns LZMA_MEMLIMIT_ERROR (increase the memory limit)
     {   
-        if ((res=lzma_code(&lzma, LZMA_RUN)) != LZMA_STREAM_END) // if error
+        if ((res=lzma_code(lzma, LZMA_RUN)) != LZMA_STREAM_END) // if error
         {
             if (res == LZMA_MEMLIMIT_ERROR) // we have to raise the memory limit
-            {   memlimit+=64*1024*1024;
-                lzma_memlimit_set(&lzma, memlimit);
-                msgprintf(MSG_VERB2, "lzma_memlimit_set(%lld)\n", (long long)memlimit);
+            {   ctx->memlimit+=64*1024*1024;
+                lzma_memlimit_set(lzma, ctx->memlimit);
+                msgprintf(MSG_VERB2, "lzma_memlimit_set(%lld)\n", (long long)ctx->memlimit);
             }
             else // another error
             {   errprintf("lzma_code(LZMA_RUN) failed with res=%d\n", res);
-                lzma_end(&lzma);
+                comp_lzma_ctx_reset_stream(lzma);
                 return FSAERR_UNKNOWN;
             }
         }
-    } while ((res == LZMA_MEMLIMIT_ERROR) && (memlimit < maxmemlimit));
+    } while ((res == LZMA_MEMLIMIT_ERROR) && (ctx->memlimit < maxmemlimit));
     
-    *origsize=(u64)(lzma.total_out);
-    lzma_end(&lzma);
+    *origsize=(u64)(lzma->total_out);
     
     switch (res)
     {
         case LZMA_STREAM_END:
             return FSAERR_SUCCESS;
         case LZMA_MEMLIMIT_ERROR:
+            comp_lzma_ctx_reset_stream(lzma);
             return FSAERR_ENOMEM;
         default:
+            comp_lzma_ctx_reset_stream(lzma);
             return FSAERR_UNKNOWN;
     }
 }
 
+// compress a block as the next part of a stream which is flushed at the end of each block: the block can be
+// uncompressed once the previous blocks of the stream have been (solid groups, see option -g)
+int compress_block_lzma_solid(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, bool newstream, clzmactx *ctx)
+{
+    lzma_stream *lzma=&ctx->solidencoder;
+    u64 startout;
+    int res;
+    
+    // the stream is never finished so there is no check to write at the end
+    if ((newstream==true) && ((res=lzma_easy_encoder(lzma, level, LZMA_CHECK_NONE))!=LZMA_OK))
+    {   errprintf("lzma_easy_encoder(%d) failed with res=%d\n", level, res);
+        comp_lzma_ctx_reset_stream(lzma);
+        return (res==LZMA_MEM_ERROR)?FSAERR_ENOMEM:FSAERR_UNKNOWN;
+    }
+    
+    startout=(u64)(lzma->total_out);
+    lzma->next_in = origbuf;
+    lzma->avail_in = origsize;
+    lzma->next_out = compbuf;
+    lzma->avail_out = compbufsize;
+    
+    // LZMA_SYNC_FLUSH returns LZMA_STREAM_END once all the input can be uncompressed from the output
+    while (((res=lzma_code(lzma, LZMA_SYNC_FLUSH))==LZMA_OK) && (lzma->avail_out>0));
+    if (res!=LZMA_STREAM_END) // an error or an output buffer too small: the stream can't be continued
+    {   comp_lzma_ctx_reset_stream(lzma);
+        return (res==LZMA_MEM_ERROR)?FSAERR_ENOMEM:FSAERR_UNKNOWN;
+    }
+    
+    *compsize=(u64)(lzma->total_out)-startout;
+    return FSAERR_SUCCESS;
+}
+
+int uncompress_block_lzma_solid(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, bool newstream, clzmactx *ctx)
+{
+    lzma_stream *lzma=&ctx->soliddecoder;
+    u64 maxmemlimit=3ULL*1024ULL*1024ULL*1024ULL;
+    u64 startout;
+    int res;
+    
+    if ((newstream==true) && ((res=lzma_auto_decoder(lzma, ctx->memlimit, 0))!=LZMA_OK))
+    {   errprintf("lzma_auto_decoder() failed with res=%d\n", res);
+        comp_lzma_ctx_reset_stream(lzma);
+        return FSAERR_UNKNOWN;
+    }
+    
+    startout=(u64)(lzma->total_out);
+    lzma->next_in = compbuf;
+    lzma->avail_in = compsize;
+    lzma->next_out = origbuf;
+    lzma->avail_out = origbufsize;
+    
+    // the block has been flushed when it was compressed: all of it comes out of its own part of the stream
+    do
+    {   if (((res=lzma_code(lzma, LZMA_RUN))==LZMA_MEMLIMIT_ERROR) && (ctx->memlimit < maxmemlimit))
+        {   ctx->memlimit+=64*1024*1024;
+            lzma_memlimit_set(lzma, ctx->memlimit);
+            msgprintf(MSG_VERB2, "lzma_memlimit_set(%lld)\n", (long long)ctx->memlimit);
+            res=LZMA_OK;
+        }
+    } while ((res==LZMA_OK) && ((lzma->avail_in>0) || (lzma->avail_out>0)));
+    
+    *origsize=(u64)(lzma->total_out)-startout;
+    
+    if ((lzma->avail_in>0) || (lzma->avail_out>0))
+    {   errprintf("lzma_code(LZMA_RUN) failed with res=%d\n", res);
+        comp_lzma_ctx_reset_stream(lzma);
+        return (res==LZMA_MEMLIMIT_ERROR)?FSAERR_ENOMEM:FSAERR_UNKNOWN;
+    }
+    return FSAERR_SUCCESS;
+}
+
 #endif // OPTION_LZMA_SUPPORT
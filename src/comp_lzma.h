@@ -20,8 +20,25 @@
 
 #ifdef OPTION_LZMA_SUPPORT
 
-int compress_block_lzma(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
-int uncompress_block_lzma(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+#include <lzma.h>
+
+struct s_lzmactx;
+typedef struct s_lzmactx clzmactx;
+
+struct s_lzmactx // lzma streams which are kept between blocks so that liblzma can reuse the coder memory
+{   lzma_stream encoder; // stream used to compress blocks (never ended between two blocks)
+    lzma_stream decoder; // stream used to uncompress blocks (never ended between two blocks)
+    lzma_stream solidencoder; // stream of the current solid group which is flushed after each block (option -g)
+    lzma_stream soliddecoder; // stream used to uncompress the blocks of the current solid group
+    u64         memlimit; // memory limit of the decoder: it is only raised once for all the blocks
+};
+
+int comp_lzma_ctx_init(clzmactx *ctx);
+int comp_lzma_ctx_destroy(clzmactx *ctx);
+int compress_block_lzma(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, clzmactx *ctx);
+int uncompress_block_lzma(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, clzmactx *ctx);
+int compress_block_lzma_solid(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, bool newstream, clzmactx *ctx);
+int uncompress_block_lzma_solid(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, bool newstream, clzmactx *ctx);
 
 #endif // OPTION_LZMA_SUPPORT
 
@@ -19,18 +19,34 @@
 #  include "config.h"
 #endif
 
+#include <stdlib.h>
+
 #include "fsarchiver.h"
 #include "comp_lzo.h"
 #include "error.h"
 
 #ifdef OPTION_LZO_SUPPORT
 
-int compress_block_lzo(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
+int comp_lzo_ctx_init(clzoctx *ctx)
+{
+    ctx->workmem=NULL;
+    return 0;
+}
+
+int comp_lzo_ctx_destroy(clzoctx *ctx)
+{
+    free(ctx->workmem);
+    return comp_lzo_ctx_init(ctx);
+}
+
+int compress_block_lzo(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, clzoctx *ctx)
 {
     lzo_uint destsize=(lzo_uint)compbufsize;
-    char workmem[LZO1X_1_MEM_COMPRESS];
     
-    switch (lzo1x_1_compress((lzo_bytep)origbuf, (lzo_uint)origsize, (lzo_bytep)compbuf, (lzo_uintp)&destsize, (lzo_voidp)workmem))
+    if ((ctx->workmem==NULL) && ((ctx->workmem=malloc(LZO1X_1_MEM_COMPRESS))==NULL))
+        return FSAERR_ENOMEM;
+    
+    switch (lzo1x_1_compress((lzo_bytep)origbuf, (lzo_uint)origsize, (lzo_bytep)compbuf, (lzo_uintp)&destsize, ctx->workmem))
     {
         case LZO_E_OK:
             *compsize=(u64)destsize;
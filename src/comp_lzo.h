@@ -22,7 +22,16 @@
 
 #include <lzo/lzo1x.h>
 
-int compress_block_lzo(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
+struct s_lzoctx;
+typedef struct s_lzoctx clzoctx;
+
+struct s_lzoctx
+{   lzo_voidp   workmem; // LZO1X_1_MEM_COMPRESS bytes allocated once per compression thread
+};
+
+int comp_lzo_ctx_init(clzoctx *ctx);
+int comp_lzo_ctx_destroy(clzoctx *ctx);
+int compress_block_lzo(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, clzoctx *ctx);
 int uncompress_block_lzo(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
 
 #endif // OPTION_LZO_SUPPORT
@@ -0,0 +1,191 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "fsarchiver.h"
+#include "common.h"
+#include "comp_zstd.h"
+#include "error.h"
+
+#ifdef OPTION_ZSTD_SUPPORT
+
+int comp_zstd_ctx_init(czstdctx *ctx)
+{
+    ctx->cctx=NULL;
+    ctx->level=0;
+    ctx->dctx=NULL;
+    ctx->cdict=NULL;
+    ctx->cdictlevel=0;
+    ctx->ddict=NULL;
+    ctx->solidcctx=NULL;
+    ctx->solidlevel=0;
+    ctx->soliddctx=NULL;
+    return 0;
+}
+
+int comp_zstd_ctx_destroy(czstdctx *ctx)
+{
+    ZSTD_freeCCtx(ctx->cctx); // accepts NULL
+    ZSTD_freeDCtx(ctx->dctx);
+    ZSTD_freeCDict(ctx->cdict);
+    ZSTD_freeDDict(ctx->ddict);
+    ZSTD_freeCCtx(ctx->solidcctx);
+    ZSTD_freeDCtx(ctx->soliddctx);
+    return comp_zstd_ctx_init(ctx);
+}
+
+// the parameters of a context are only set again when the level changes
+static int comp_zstd_set_level(ZSTD_CCtx **cctx, int *curlevel, int level)
+{
+    size_t res;
+    
+    if ((*cctx==NULL) && ((*cctx=ZSTD_createCCtx())==NULL))
+        return FSAERR_ENOMEM;
+    
+    if (*curlevel!=level)
+    {
+        if (ZSTD_isError(res=ZSTD_CCtx_setParameter(*cctx, ZSTD_c_compressionLevel, level))
+            || ZSTD_isError(res=ZSTD_CCtx_setParameter(*cctx, ZSTD_c_enableLongDistanceMatching, (level>=FSA_ZSTD_LDMLEVEL))))
+        {   errprintf("ZSTD_CCtx_setParameter(%d) failed: %s\n", level, ZSTD_getErrorName(res));
+            return FSAERR_UNKNOWN;
+        }
+        *curlevel=level;
+    }
+    
+    return FSAERR_SUCCESS;
+}
+
+int compress_block_zstd(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, u8 *dict, u32 dictsize, czstdctx *ctx)
+{
+    size_t res;
+    int ret;
+    
+    if ((ret=comp_zstd_set_level(&ctx->cctx, &ctx->level, level))!=FSAERR_SUCCESS)
+        return ret;
+    
+    // the dictionary never changes during an operation: it's only digested again when the level changes
+    if ((dict!=NULL) && ((ctx->cdict==NULL) || (ctx->cdictlevel!=level)))
+    {   ZSTD_freeCDict(ctx->cdict);
+        if ((ctx->cdict=ZSTD_createCDict(dict, dictsize, level))==NULL)
+            return FSAERR_ENOMEM;
+        ctx->cdictlevel=level;
+    }
+    
+    // ZSTD_compress2() starts a new frame each time and keeps the parameters which have been set
+    if (dict!=NULL)
+        res=ZSTD_compress_usingCDict(ctx->cctx, compbuf, compbufsize, origbuf, origsize, ctx->cdict);
+    else
+        res=ZSTD_compress2(ctx->cctx, compbuf, compbufsize, origbuf, origsize);
+    if (ZSTD_isError(res))
+    {   switch (ZSTD_getErrorCode(res))
+        {
+            case ZSTD_error_memory_allocation:
+                errprintf("ZSTD_compress2(%d): ZSTD compression failed with an out of memory error.\n"
+                    "You should use a lower compression level to reduce the memory requirement.\n", level);
+                return FSAERR_ENOMEM;
+            default: // ZSTD_error_dstSize_tooSmall: the block is not compressible
+                return FSAERR_UNKNOWN;
+        }
+    }
+    
+    *compsize=(u64)res;
+    return FSAERR_SUCCESS;
+}
+
+int uncompress_block_zstd(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, u8 *dict, u32 dictsize, czstdctx *ctx)
+{
+    size_t res;
+    
+    if ((ctx->dctx==NULL) && ((ctx->dctx=ZSTD_createDCtx())==NULL))
+        return FSAERR_ENOMEM;
+    
+    if ((dict!=NULL) && (ctx->ddict==NULL) && ((ctx->ddict=ZSTD_createDDict(dict, dictsize))==NULL))
+        return FSAERR_ENOMEM;
+    
+    if (dict!=NULL)
+        res=ZSTD_decompress_usingDDict(ctx->dctx, origbuf, origbufsize, compbuf, compsize, ctx->ddict);
+    else
+        res=ZSTD_decompressDCtx(ctx->dctx, origbuf, origbufsize, compbuf, compsize);
+    if (ZSTD_isError(res))
+    {   errprintf("ZSTD_decompressDCtx() failed: %s\n", ZSTD_getErrorName(res));
+        return (ZSTD_getErrorCode(res)==ZSTD_error_memory_allocation)?FSAERR_ENOMEM:FSAERR_UNKNOWN;
+    }
+    
+    *origsize=(u64)res;
+    return FSAERR_SUCCESS;
+}
+
+// compress a block as the next part of a frame which is flushed at the end of each block: the block can be
+// uncompressed once the previous blocks of the frame have been (solid groups, see option -g)
+int compress_block_zstd_solid(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, bool newstream, czstdctx *ctx)
+{
+    ZSTD_inBuffer in={origbuf, origsize, 0};
+    ZSTD_outBuffer out={compbuf, compbufsize, 0};
+    size_t res;
+    int ret;
+    
+    // the level of a frame can't change: a new frame is started when the level is not the same
+    if (newstream==true)
+    {   if (ctx->solidcctx!=NULL)
+            ZSTD_CCtx_reset(ctx->solidcctx, ZSTD_reset_session_only);
+        if ((ret=comp_zstd_set_level(&ctx->solidcctx, &ctx->solidlevel, level))!=FSAERR_SUCCESS)
+            return ret;
+    }
+    
+    // ZSTD_e_flush returns 0 once all the input can be uncompressed from the output
+    while (!ZSTD_isError(res=ZSTD_compressStream2(ctx->solidcctx, &out, &in, ZSTD_e_flush)) && (res>0) && (out.pos<out.size));
+    if (ZSTD_isError(res) || (res>0)) // an error or an output buffer too small: the frame can't be continued
+    {   ZSTD_CCtx_reset(ctx->solidcctx, ZSTD_reset_session_only);
+        return (ZSTD_isError(res) && (ZSTD_getErrorCode(res)==ZSTD_error_memory_allocation))?FSAERR_ENOMEM:FSAERR_UNKNOWN;
+    }
+    
+    *compsize=(u64)out.pos;
+    return FSAERR_SUCCESS;
+}
+
+int uncompress_block_zstd_solid(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, bool newstream, czstdctx *ctx)
+{
+    ZSTD_inBuffer in={compbuf, compsize, 0};
+    ZSTD_outBuffer out={origbuf, origbufsize, 0};
+    size_t prevpos;
+    size_t res=0;
+    
+    if ((ctx->soliddctx==NULL) && ((ctx->soliddctx=ZSTD_createDCtx())==NULL))
+        return FSAERR_ENOMEM;
+    if (newstream==true)
+        ZSTD_DCtx_reset(ctx->soliddctx, ZSTD_reset_session_only);
+    
+    // the block has been flushed when it was compressed: all of it comes out of its own part of the frame
+    do
+    {   prevpos=in.pos+out.pos;
+        res=ZSTD_decompressStream(ctx->soliddctx, &out, &in);
+    } while (!ZSTD_isError(res) && ((in.pos<in.size) || (out.pos<out.size)) && (in.pos+out.pos>prevpos));
+    
+    *origsize=(u64)out.pos;
+    
+    if (ZSTD_isError(res) || (in.pos<in.size) || (out.pos<out.size))
+    {   errprintf("ZSTD_decompressStream() failed: %s\n", ZSTD_isError(res)?ZSTD_getErrorName(res):"truncated block");
+        ZSTD_DCtx_reset(ctx->soliddctx, ZSTD_reset_session_only);
+        return (ZSTD_isError(res) && (ZSTD_getErrorCode(res)==ZSTD_error_memory_allocation))?FSAERR_ENOMEM:FSAERR_UNKNOWN;
+    }
+    return FSAERR_SUCCESS;
+}
+
+#endif // OPTION_ZSTD_SUPPORT
@@ -0,0 +1,54 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __COMPRESS_ZSTD_H__
+#define __COMPRESS_ZSTD_H__
+
+#define FSA_ZSTD_MINLEVEL        1
+#define FSA_ZSTD_MAXLEVEL        22
+#define FSA_ZSTD_LDMLEVEL        19             // long distance matching is enabled from this level
+
+#ifdef OPTION_ZSTD_SUPPORT
+
+#include <zstd.h>
+#include <zstd_errors.h>
+
+struct s_zstdctx;
+typedef struct s_zstdctx czstdctx;
+
+struct s_zstdctx // zstd contexts which are reused for all the blocks processed by a thread
+{   ZSTD_CCtx   *cctx; // compression context (parameters are only set again when the level changes)
+    int         level; // level which has been set in cctx or 0 if no level has been set yet
+    ZSTD_DCtx   *dctx; // decompression context
+    ZSTD_CDict  *cdict; // dictionary of the archive digested for compression (see compdict.c)
+    int         cdictlevel; // level cdict has been created for
+    ZSTD_DDict  *ddict; // dictionary of the archive digested for decompression
+    ZSTD_CCtx   *solidcctx; // context of the frame of the current solid group (option -g)
+    int         solidlevel; // level which has been set in solidcctx or 0
+    ZSTD_DCtx   *soliddctx; // context used to uncompress the frame of the current solid group
+};
+
+int comp_zstd_ctx_init(czstdctx *ctx);
+int comp_zstd_ctx_destroy(czstdctx *ctx);
+int compress_block_zstd(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, u8 *dict, u32 dictsize, czstdctx *ctx);
+int uncompress_block_zstd(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, u8 *dict, u32 dictsize, czstdctx *ctx);
+int compress_block_zstd_solid(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, bool newstream, czstdctx *ctx);
+int uncompress_block_zstd_solid(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, bool newstream, czstdctx *ctx);
+
+#endif // OPTION_ZSTD_SUPPORT
+
+#endif // __COMPRESS_ZSTD_H__
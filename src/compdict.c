@@ -0,0 +1,179 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef OPTION_ZSTD_SUPPORT
+#include <zdict.h>
+#endif // OPTION_ZSTD_SUPPORT
+
+#include "fsarchiver.h"
+#include "compdict.h"
+#include "common.h"
+#include "dico.h"
+#include "error.h"
+
+// small files are packed together in blocks (see regmulti.c) and each block is compressed on its own,
+// so the compressor has to learn again the words which are common to all the files in each block.
+// With option -D a dictionary is built from samples of small files during the analysis of the
+// directories, it's written once in the archive, and the blocks of small files are compressed with
+// it (with gzip and zstd only). The reader thread loads it before the blocks which need it.
+u8   *g_dictsamples=NULL; // FSA_DICT_SAMPLES slots of FSA_DICT_SAMPLESIZE bytes
+u32  g_dictsamplesizes[FSA_DICT_SAMPLES]; // how many bytes are used in each slot
+u32  g_dictsamplecount=0; // how many slots are used
+u64  g_dictfilecount=0; // how many small files have been seen (all of them cannot be sampled)
+u8   *g_dictdata=NULL; // dictionary used to compress and uncompress the blocks of small files
+u32  g_dictsize=0;
+
+int compdict_init()
+{
+    g_dictsamples=NULL;
+    g_dictsamplecount=0;
+    g_dictfilecount=0;
+    g_dictdata=NULL;
+    g_dictsize=0;
+    return 0;
+}
+
+int compdict_destroy()
+{
+    free(g_dictsamples);
+    free(g_dictdata);
+    return compdict_init();
+}
+
+// reservoir sampling: every small file seen so far has the same chance to be in the samples
+int compdict_add_sample(char *fullpath, u64 filesize)
+{
+    u64 slot;
+    int res;
+    int fd;
+    
+    if ((g_dictsamples==NULL) && ((g_dictsamples=malloc(FSA_DICT_SAMPLES*FSA_DICT_SAMPLESIZE))==NULL))
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)(FSA_DICT_SAMPLES*FSA_DICT_SAMPLESIZE));
+        return -1;
+    }
+    
+    g_dictfilecount++;
+    if (g_dictsamplecount<FSA_DICT_SAMPLES)
+        slot=g_dictsamplecount;
+    else if ((slot=((u64)random()) % g_dictfilecount)>=FSA_DICT_SAMPLES)
+        return 0;
+    
+    if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0)
+        return 0; // the real backup will report the error
+    res=read(fd, g_dictsamples+slot*FSA_DICT_SAMPLESIZE, min(filesize, FSA_DICT_SAMPLESIZE));
+    close(fd);
+    if (res<=0)
+        return 0;
+    
+    g_dictsamplesizes[slot]=res;
+    if (slot==g_dictsamplecount)
+        g_dictsamplecount++;
+    return 0;
+}
+
+// the dictionary is trained by zstd when it's available, else the samples are used as they are
+int compdict_build()
+{
+#ifdef OPTION_ZSTD_SUPPORT
+    size_t sizes[FSA_DICT_SAMPLES];
+    size_t res;
+#endif // OPTION_ZSTD_SUPPORT
+    u64 total;
+    u32 i;
+    
+    free(g_dictdata);
+    g_dictdata=NULL;
+    g_dictsize=0;
+    
+    if (g_dictsamplecount<FSA_DICT_MINSAMPLES)
+    {   msgprintf(MSG_VERB2, "not enough small files to build a dictionary (%ld)\n", (long)g_dictsamplecount);
+        goto compdict_build_free;
+    }
+    
+    // the samples must be contiguous
+    for (total=0, i=0; i<g_dictsamplecount; i++)
+    {   memmove(g_dictsamples+total, g_dictsamples+i*FSA_DICT_SAMPLESIZE, g_dictsamplesizes[i]);
+        total+=g_dictsamplesizes[i];
+    }
+    
+    if ((g_dictdata=malloc(FSA_DICT_MAXSIZE))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)FSA_DICT_MAXSIZE);
+        goto compdict_build_free;
+    }
+    
+#ifdef OPTION_ZSTD_SUPPORT
+    for (i=0; i<g_dictsamplecount; i++)
+        sizes[i]=g_dictsamplesizes[i];
+    res=ZDICT_trainFromBuffer(g_dictdata, FSA_DICT_MAXSIZE, g_dictsamples, sizes, g_dictsamplecount);
+    if (ZDICT_isError(res))
+        msgprintf(MSG_VERB2, "ZDICT_trainFromBuffer() failed: %s: the samples are used instead\n", ZDICT_getErrorName(res));
+    else
+        g_dictsize=(u32)res;
+#endif // OPTION_ZSTD_SUPPORT
+    
+    // raw dictionary: the end of the samples (deflate gives the priority to the last bytes)
+    if (g_dictsize==0)
+    {   g_dictsize=min(total, FSA_DICT_MAXSIZE);
+        memcpy(g_dictdata, g_dictsamples+total-g_dictsize, g_dictsize);
+    }
+    msgprintf(MSG_VERB2, "dictionary of %ld bytes built from %ld small files\n", (long)g_dictsize, (long)g_dictsamplecount);
+    
+compdict_build_free:
+    free(g_dictsamples);
+    g_dictsamples=NULL;
+    return 0;
+}
+
+int compdict_write_header(cdico *d)
+{
+    if (g_dictsize==0)
+        return -1;
+    return dico_add_data(d, 0, DICTHEADKEY_DATA, g_dictdata, (u16)g_dictsize);
+}
+
+int compdict_read_header(cdico *d)
+{
+    u16 size;
+    
+    free(g_dictdata);
+    g_dictsize=0;
+    if ((g_dictdata=malloc(FSA_DICT_MAXSIZE))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)FSA_DICT_MAXSIZE);
+        return -1;
+    }
+    if (dico_get_data(d, 0, DICTHEADKEY_DATA, g_dictdata, FSA_DICT_MAXSIZE, &size)!=0)
+    {   errprintf("cannot read DICTHEADKEY_DATA from the dictionary header\n");
+        return -1;
+    }
+    g_dictsize=size;
+    return 0;
+}
+
+// returns the dictionary or NULL if the archive does not have one
+u8 *compdict_get(u32 *size)
+{
+    *size=g_dictsize;
+    return (g_dictsize>0)?g_dictdata:NULL;
+}
@@ -0,0 +1,37 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __COMPDICT_H__
+#define __COMPDICT_H__
+
+#define FSA_DICT_MAXSIZE         16384          // size of the dictionary (stored in every archive so it must stay small)
+#define FSA_DICT_GZIPSIZE        32768          // deflate can only use the last 32KB of the dictionary
+#define FSA_DICT_SAMPLES         1024           // how many small files are sampled to build the dictionary
+#define FSA_DICT_SAMPLESIZE      4096           // how many bytes are read at the beginning of each sampled file
+#define FSA_DICT_MINSAMPLES      32             // there is no dictionary with fewer small files
+
+struct s_dico;
+
+int  compdict_init();
+int  compdict_destroy();
+int  compdict_add_sample(char *fullpath, u64 filesize);
+int  compdict_build();
+int  compdict_write_header(struct s_dico *d);
+int  compdict_read_header(struct s_dico *d);
+u8   *compdict_get(u32 *size);
+
+#endif // __COMPDICT_H__
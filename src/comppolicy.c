@@ -0,0 +1,120 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+#include <strings.h>
+
+#include "fsarchiver.h"
+#include "comppolicy.h"
+
+// with option -t the compression of each large file depends on its type: data which is already
+// compressed is stored as it is, big images of disks are compressed with the fastest algorithm,
+// and text and databases (which compress very well) with the best one
+struct s_comppolicyext
+{   char     *ext; // extension of the file name (without the dot)
+    int      policy; // COMPPOLICY_xxx
+};
+
+struct s_comppolicymagic
+{   u32      offset; // where the magic is in the first block of the file
+    char     *magic;
+    u32      len; // magic may contain zeros
+    int      policy; // COMPPOLICY_xxx
+};
+
+static struct s_comppolicyext g_comppolicyext[]=
+{
+    // archives and compressed files
+    {"gz", COMPPOLICY_STORE}, {"tgz", COMPPOLICY_STORE}, {"bz2", COMPPOLICY_STORE}, {"tbz2", COMPPOLICY_STORE},
+    {"xz", COMPPOLICY_STORE}, {"txz", COMPPOLICY_STORE}, {"lzma", COMPPOLICY_STORE}, {"zst", COMPPOLICY_STORE},
+    {"lz4", COMPPOLICY_STORE}, {"lzo", COMPPOLICY_STORE}, {"zip", COMPPOLICY_STORE}, {"7z", COMPPOLICY_STORE},
+    {"rar", COMPPOLICY_STORE}, {"cab", COMPPOLICY_STORE}, {"jar", COMPPOLICY_STORE}, {"apk", COMPPOLICY_STORE},
+    {"deb", COMPPOLICY_STORE}, {"rpm", COMPPOLICY_STORE}, {"fsa", COMPPOLICY_STORE}, {"squashfs", COMPPOLICY_STORE},
+    {"docx", COMPPOLICY_STORE}, {"xlsx", COMPPOLICY_STORE}, {"pptx", COMPPOLICY_STORE}, {"odt", COMPPOLICY_STORE},
+    {"ods", COMPPOLICY_STORE}, {"odp", COMPPOLICY_STORE}, {"epub", COMPPOLICY_STORE},
+    // pictures, music and videos
+    {"jpg", COMPPOLICY_STORE}, {"jpeg", COMPPOLICY_STORE}, {"png", COMPPOLICY_STORE}, {"gif", COMPPOLICY_STORE},
+    {"webp", COMPPOLICY_STORE}, {"heic", COMPPOLICY_STORE}, {"mp3", COMPPOLICY_STORE}, {"m4a", COMPPOLICY_STORE},
+    {"aac", COMPPOLICY_STORE}, {"ogg", COMPPOLICY_STORE}, {"opus", COMPPOLICY_STORE}, {"flac", COMPPOLICY_STORE},
+    {"mp4", COMPPOLICY_STORE}, {"m4v", COMPPOLICY_STORE}, {"mkv", COMPPOLICY_STORE}, {"webm", COMPPOLICY_STORE},
+    {"avi", COMPPOLICY_STORE}, {"mov", COMPPOLICY_STORE}, {"wmv", COMPPOLICY_STORE},
+    // images of disks and virtual machines: big and with a mix of everything
+    {"img", COMPPOLICY_FAST}, {"iso", COMPPOLICY_FAST}, {"qcow2", COMPPOLICY_FAST}, {"vmdk", COMPPOLICY_FAST},
+    {"vdi", COMPPOLICY_FAST}, {"vhd", COMPPOLICY_FAST}, {"vhdx", COMPPOLICY_FAST},
+    // text, logs and databases
+    {"txt", COMPPOLICY_STRONG}, {"log", COMPPOLICY_STRONG}, {"csv", COMPPOLICY_STRONG}, {"tsv", COMPPOLICY_STRONG},
+    {"json", COMPPOLICY_STRONG}, {"xml", COMPPOLICY_STRONG}, {"html", COMPPOLICY_STRONG}, {"htm", COMPPOLICY_STRONG},
+    {"sql", COMPPOLICY_STRONG}, {"db", COMPPOLICY_STRONG}, {"sqlite", COMPPOLICY_STRONG}, {"mdb", COMPPOLICY_STRONG},
+    {"ibd", COMPPOLICY_STRONG}, {"dbf", COMPPOLICY_STRONG},
+    {NULL, COMPPOLICY_DEFAULT},
+};
+
+static struct s_comppolicymagic g_comppolicymagic[]=
+{
+    {0, "\x1f\x8b", 2, COMPPOLICY_STORE}, // gzip
+    {0, "BZh", 3, COMPPOLICY_STORE}, // bzip2
+    {0, "\xfd" "7zXZ\0", 6, COMPPOLICY_STORE}, // xz
+    {0, "\x28\xb5\x2f\xfd", 4, COMPPOLICY_STORE}, // zstd
+    {0, "\x04\x22\x4d\x18", 4, COMPPOLICY_STORE}, // lz4
+    {0, "PK\x03\x04", 4, COMPPOLICY_STORE}, // zip and all the formats based on it
+    {0, "7z\xbc\xaf\x27\x1c", 6, COMPPOLICY_STORE}, // 7-zip
+    {0, "Rar!", 4, COMPPOLICY_STORE}, // rar
+    {0, "\xff\xd8\xff", 3, COMPPOLICY_STORE}, // jpeg
+    {0, "\x89PNG", 4, COMPPOLICY_STORE}, // png
+    {0, "GIF8", 4, COMPPOLICY_STORE}, // gif
+    {0, "OggS", 4, COMPPOLICY_STORE}, // ogg
+    {0, "fLaC", 4, COMPPOLICY_STORE}, // flac
+    {0, "ID3", 3, COMPPOLICY_STORE}, // mp3
+    {4, "ftyp", 4, COMPPOLICY_STORE}, // mp4 and quicktime
+    {0, "\x1a\x45\xdf\xa3", 4, COMPPOLICY_STORE}, // matroska and webm
+    {0, "hsqs", 4, COMPPOLICY_STORE}, // squashfs
+    {0, "QFI\xfb", 4, COMPPOLICY_FAST}, // qcow2
+    {0, "SQLite format 3", 16, COMPPOLICY_STRONG}, // sqlite
+    {0, NULL, 0, COMPPOLICY_DEFAULT},
+};
+
+// policy of a file from the extension of its name (COMPPOLICY_DEFAULT if unknown)
+int comppolicy_from_name(char *path)
+{
+    char *ext;
+    int i;
+    
+    if (!path || ((ext=strrchr(path, '.'))==NULL) || (strchr(ext, '/')!=NULL))
+        return COMPPOLICY_DEFAULT;
+    
+    for (i=0, ext++; g_comppolicyext[i].ext!=NULL; i++)
+        if (strcasecmp(ext, g_comppolicyext[i].ext)==0)
+            return g_comppolicyext[i].policy;
+    
+    return COMPPOLICY_DEFAULT;
+}
+
+// policy of a file from the magic found at the beginning of its first block (COMPPOLICY_DEFAULT if unknown)
+int comppolicy_from_data(u8 *data, u32 size)
+{
+    struct s_comppolicymagic *cur;
+    
+    for (cur=g_comppolicymagic; cur->magic!=NULL; cur++)
+        if ((cur->offset+cur->len<=size) && (memcmp(data+cur->offset, cur->magic, cur->len)==0))
+            return cur->policy;
+    
+    return COMPPOLICY_DEFAULT;
+}
@@ -0,0 +1,26 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __COMPPOLICY_H__
+#define __COMPPOLICY_H__
+
+enum {COMPPOLICY_DEFAULT=0, COMPPOLICY_STORE, COMPPOLICY_FAST, COMPPOLICY_STRONG};
+
+int comppolicy_from_name(char *path);
+int comppolicy_from_data(u8 *data, u32 size);
+
+#endif // __COMPPOLICY_H__
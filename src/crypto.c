@@ -22,10 +22,12 @@
 #include <pthread.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <sys/time.h>
 
 #include "fsarchiver.h"
 #include "common.h"
 #include "crypto.h"
+#include "syncthread.h"
 #include "error.h"
 
 #include <gcrypt.h>
@@ -33,6 +35,14 @@
 // required for safety with multi-threading in gcrypt
 GCRY_THREAD_OPTION_PTHREAD_IMPL;
 
+// key of the archive derived from the password (see crypto_set_key()): the compression threads set it
+// in their own cipher handle the first time they need it, or again when the serial has changed
+static u8 g_cryptkey[FSA_CRYPT_KEYSIZE];
+static u32 g_cryptkeyserial=0;
+static u64 g_cryptnonce=0;
+static pthread_mutex_t g_cryptkeymutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cryptkeycond=PTHREAD_COND_INITIALIZER;
+
 int crypto_init()
 {
     // init gcrypt for multi-threading
@@ -110,6 +120,159 @@ int crypto_blowfish(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *passwor
     return (res==0)?(0):(-1);
 }
 
+int crypto_derive_key(u8 *password, int passlen, u8 *salt, int saltlen, u32 iterations, u8 *key)
+{
+    if ((password==NULL) || (passlen==0) || (salt==NULL) || (iterations==0))
+        return -1;
+    
+    if (gcry_kdf_derive(password, passlen, GCRY_KDF_PBKDF2, GCRY_MD_SHA256, salt, saltlen, iterations, FSA_CRYPT_KEYSIZE, key)!=0)
+    {   errprintf("gcry_kdf_derive() failed\n");
+        return -1;
+    }
+    
+    return 0;
+}
+
+// the key is only given to the compression threads once it's known to be right
+int crypto_set_key(u8 *key)
+{
+    pthread_mutex_lock(&g_cryptkeymutex);
+    memcpy(g_cryptkey, key, FSA_CRYPT_KEYSIZE);
+    __sync_add_and_fetch(&g_cryptkeyserial, 1);
+    pthread_cond_broadcast(&g_cryptkeycond);
+    pthread_mutex_unlock(&g_cryptkeymutex);
+    return 0;
+}
+
+// when restoring, the threads can get the first blocks before the main thread has read the main header
+// and derived the key: wait for it unless the operation is being stopped
+static u32 crypto_wait_key()
+{
+    struct timespec until;
+    struct timeval now;
+    u32 keyserial;
+    
+    pthread_mutex_lock(&g_cryptkeymutex);
+    while (((keyserial=g_cryptkeyserial)==0) && (get_stopfillqueue()==false) && (get_abort()==false))
+    {   gettimeofday(&now, NULL);
+        until.tv_sec=now.tv_sec+1;
+        until.tv_nsec=now.tv_usec*1000;
+        pthread_cond_timedwait(&g_cryptkeycond, &g_cryptkeymutex, &until);
+    }
+    pthread_mutex_unlock(&g_cryptkeymutex);
+    return keyserial;
+}
+
+u64 crypto_new_nonce()
+{
+    return __sync_add_and_fetch(&g_cryptnonce, 1);
+}
+
+int crypto_ctx_init(ccryptctx *ctx)
+{
+    ctx->hd=NULL;
+    ctx->keyserial=0;
+    return 0;
+}
+
+// use a key which has not been given to the threads yet (see crypto_set_key()) to check the password
+int crypto_ctx_setkey(ccryptctx *ctx, u8 *key)
+{
+    int res;
+    
+    if ((ctx->hd==NULL) && ((res=gcry_cipher_open(&ctx->hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM, 0))!=0))
+    {   errprintf("gcry_cipher_open() failed: %s\n", gcry_strerror(res));
+        ctx->hd=NULL;
+        return -1;
+    }
+    
+    if ((res=gcry_cipher_setkey(ctx->hd, key, FSA_CRYPT_KEYSIZE))!=0)
+    {   errprintf("gcry_cipher_setkey() failed: %s\n", gcry_strerror(res));
+        return -1;
+    }
+    
+    ctx->keyserial=FSA_CRYPT_OWNKEY;
+    return 0;
+}
+
+int crypto_ctx_destroy(ccryptctx *ctx)
+{
+    if (ctx->hd!=NULL)
+        gcry_cipher_close(ctx->hd);
+    ctx->hd=NULL;
+    ctx->keyserial=0;
+    return 0;
+}
+
+// the block is authenticated with the data passed in aad (the header fields it depends on) and the tag is
+// written after the encrypted data: outbuf must be FSA_CRYPT_TAGSIZE bytes bigger than the input
+int crypto_aes256gcm(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u64 nonce, u8 *aad, int aadlen, int enc, ccryptctx *ctx)
+{
+    u8 iv[FSA_CRYPT_NONCESIZE];
+    u32 keyserial;
+    u64 datasize;
+    u64 lenonce;
+    int res;
+    
+    if (ctx->keyserial!=FSA_CRYPT_OWNKEY)
+    {
+        if ((keyserial=__sync_fetch_and_add(&g_cryptkeyserial, 0))==0)
+            keyserial=crypto_wait_key();
+        if (keyserial==0) // the operation is being stopped: the password may be wrong
+        {   msgprintf(MSG_DEBUG1, "the encryption key has not been derived from the password\n");
+            return -1;
+        }
+        
+        if ((ctx->hd==NULL) && ((res=gcry_cipher_open(&ctx->hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM, 0))!=0))
+        {   errprintf("gcry_cipher_open() failed: %s\n", gcry_strerror(res));
+            ctx->hd=NULL;
+            return -1;
+        }
+        
+        if ((ctx->keyserial!=keyserial) && ((res=gcry_cipher_setkey(ctx->hd, g_cryptkey, FSA_CRYPT_KEYSIZE))!=0))
+        {   errprintf("gcry_cipher_setkey() failed: %s\n", gcry_strerror(res));
+            return -1;
+        }
+        ctx->keyserial=keyserial;
+    }
+    
+    // a nonce must never be used twice with the same key: the key is unique to the archive (random salt)
+    memset(iv, 0, sizeof(iv));
+    lenonce=cpu_to_le64(nonce);
+    memcpy(iv, &lenonce, sizeof(lenonce));
+    if ((res=gcry_cipher_setiv(ctx->hd, iv, sizeof(iv)))!=0)
+    {   errprintf("gcry_cipher_setiv() failed: %s\n", gcry_strerror(res));
+        return -1;
+    }
+    
+    if ((aadlen>0) && ((res=gcry_cipher_authenticate(ctx->hd, aad, aadlen))!=0))
+    {   errprintf("gcry_cipher_authenticate() failed: %s\n", gcry_strerror(res));
+        return -1;
+    }
+    
+    switch(enc)
+    {
+        case 1: // encrypt
+            if (((res=gcry_cipher_encrypt(ctx->hd, outbuf, insize, inbuf, insize))==0) && 
+                ((res=gcry_cipher_gettag(ctx->hd, outbuf+insize, FSA_CRYPT_TAGSIZE))==0))
+                *outsize=insize+FSA_CRYPT_TAGSIZE;
+            break;
+        case 0: // decrypt
+            if (insize<FSA_CRYPT_TAGSIZE)
+                return -1;
+            datasize=insize-FSA_CRYPT_TAGSIZE;
+            if (((res=gcry_cipher_decrypt(ctx->hd, outbuf, datasize, inbuf, datasize))==0) && 
+                ((res=gcry_cipher_checktag(ctx->hd, inbuf+datasize, FSA_CRYPT_TAGSIZE))==0))
+                *outsize=datasize;
+            break;
+        default: // invalid
+            errprintf("invalid parameter: enc=%d\n", (int)enc);
+            return -1;
+    }
+    
+    return (res==0)?(0):(-1);
+}
+
 int crypto_random(u8 *buf, int bufsize)
 {
     memset(buf, 0, bufsize);
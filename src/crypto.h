@@ -18,10 +18,34 @@
 #ifndef __CRYPTO_H__
 #define __CRYPTO_H__
 
+#include <gcrypt.h>
+
 #include "types.h"
 
+#define FSA_CRYPT_KEYSIZE        32             // AES-256
+#define FSA_CRYPT_SALTSIZE       16             // random salt stored in the main header
+#define FSA_CRYPT_NONCESIZE      12             // GCM nonce: built from the number of the block
+#define FSA_CRYPT_TAGSIZE        16             // authentication tag written after each encrypted block
+#define FSA_CRYPT_KDFITER        100000         // PBKDF2 iterations used to derive the key from the password
+#define FSA_CRYPT_OWNKEY         0xFFFFFFFF     // keyserial of a context which has its own key (crypto_ctx_setkey())
+
+struct s_cryptctx;
+typedef struct s_cryptctx ccryptctx;
+
+struct s_cryptctx // cipher handle owned by a compression thread: the key schedule is only done once
+{   gcry_cipher_hd_t hd; // AES-256-GCM handle or NULL if it has not been opened yet
+    u32              keyserial; // serial of the key which has been set in hd (see crypto_set_key())
+};
+
 int crypto_init();
 int crypto_blowfish(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *password, int passlen, int enc);
+int crypto_derive_key(u8 *password, int passlen, u8 *salt, int saltlen, u32 iterations, u8 *key);
+int crypto_set_key(u8 *key);
+u64 crypto_new_nonce();
+int crypto_ctx_init(ccryptctx *ctx);
+int crypto_ctx_setkey(ccryptctx *ctx, u8 *key);
+int crypto_ctx_destroy(ccryptctx *ctx);
+int crypto_aes256gcm(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u64 nonce, u8 *aad, int aadlen, int enc, ccryptctx *ctx);
 int crypto_random(u8 *buf, int bufsize);
 int crypto_cleanup();
 
@@ -26,10 +26,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
-#include <gcrypt.h>
 
 #include "fsarchiver.h"
 #include "datafile.h"
+#include "zeroblock.h"
 #include "common.h"
 #include "error.h"
 
@@ -39,7 +39,6 @@ struct s_datafile
     bool open; // true when file is open even if simulation
     bool sparse; // true if that's a sparse file
     char path[PATH_MAX]; // path to file
-    gcry_md_hd_t md5ctx; // struct for md5
 };
 
 cdatafile *datafile_alloc()
@@ -60,7 +59,7 @@ int datafile_destroy(cdatafile *f)
     assert(f);
     
     if (f->open)
-        datafile_close(f, NULL, 0);
+        datafile_close(f);
     
     free(f);
     return 0;
@@ -90,11 +89,6 @@ int datafile_open_write(cdatafile *f, char *path, bool simul, bool sparse)
         }
     }
     
-    if (gcry_md_open(&f->md5ctx, GCRY_MD_MD5, 0) != GPG_ERR_NO_ERROR)
-    {   errprintf("gcry_md_open() failed\n");
-        return -1;
-    }
-    
     snprintf(f->path, PATH_MAX, "%s", path);
     f->simul=simul;
     f->open=true;
@@ -104,14 +98,7 @@ int datafile_open_write(cdatafile *f, char *path, bool simul, bool sparse)
 
 int datafile_is_block_zero(cdatafile *f, char *data, u64 len)
 {
-    bool zero=true;
-    u64 pos;
-    
-    for (pos=0; (pos<len) && (zero==true); pos++)
-        if (data[pos]!=0)
-            zero=false;
-    
-    return zero;
+    return is_block_zero(data, len);
 }
 
 int datafile_write(cdatafile *f, char *data, u64 len)
@@ -151,38 +138,36 @@ int datafile_write(cdatafile *f, char *data, u64 len)
         }
     }
     
-    gcry_md_write(f->md5ctx, data, len);
-    
     return FSAERR_SUCCESS;
 }
 
-int datafile_close(cdatafile *f, u8 *md5bufdat, int md5bufsize)
+// the bytes which are skipped are a hole: datafile_close() sets the size of sparse files to the final position
+int datafile_seek(cdatafile *f, u64 offset)
 {
-    char md5store[16];
-    u8 *md5tmp;
-    int res=0;
-    
     assert(f);
     
     if (!f->open)
     {   errprintf("File is not open\n");
-        return -1;
+        return FSAERR_NOTOPEN;
     }
     
-    if ((md5tmp=gcry_md_read(f->md5ctx, GCRY_MD_MD5))==NULL)
-    {   errprintf("gcry_md_read() failed\n");
-        return -1;
+    if ((f->simul==false) && (lseek64(f->fd, offset, SEEK_SET)<0))
+    {   sysprintf("Can't lseek64() in file [%s]\n", f->path);
+        return FSAERR_SEEK;
     }
-    memcpy(md5store, md5tmp, 16);
-    gcry_md_close(f->md5ctx);
     
-    if (md5bufdat!=NULL)
-    {
-        if (md5bufsize < 16)
-        {   errprintf("Buffer too small for md5 checksum\n");
-            return -1;
-        }
-        memcpy(md5bufdat, md5store, 16);
+    return FSAERR_SUCCESS;
+}
+
+int datafile_close(cdatafile *f)
+{
+    int res=0;
+    
+    assert(f);
+    
+    if (!f->open)
+    {   errprintf("File is not open\n");
+        return -1;
     }
     
     if ((f->open==true) && (f->simul==false))
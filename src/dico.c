@@ -196,6 +196,21 @@ int dico_count_all_sections(cdico *d)
     return count;
 }
 
+// how much memory the dico uses (items and their data)
+u64 dico_get_memory(cdico *d)
+{
+    cdicoitem *item;
+    u64 total;
+    
+    assert(d);
+    
+    total=sizeof(cdico);
+    for (item=d->head; item!=NULL; item=item->next)
+        total+=sizeof(cdicoitem)+item->size;
+    
+    return total;
+}
+
 int dico_add_u16(cdico *d, u8 section, u16 key, u16 data)
 {
     u16 ledata;
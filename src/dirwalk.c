@@ -0,0 +1,476 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "fsarchiver.h"
+#include "dirwalk.h"
+#include "common.h"
+#include "options.h"
+#include "syncthread.h"
+#include "error.h"
+
+// The walker threads read the directories (getdents64 + statx of every entry) before the main thread needs them.
+// The main thread still saves the objects in the order of a simple recursive walk, so the archive is the same
+// whatever the number of threads: it only waits when the directory it needs has not been scanned yet, and it
+// scans the directory itself when no thread has started it. The directories to scan are kept in the order
+// the main thread will need them: the subdirectories of a directory are inserted at the head of the list.
+
+static void walkdir_list_add(cwalkdir **list, cwalkdir *d)
+{
+    d->prev=NULL;
+    d->next=*list;
+    if (*list!=NULL)
+        (*list)->prev=d;
+    *list=d;
+}
+
+static void walkdir_list_del(cwalkdir **list, cwalkdir *d)
+{
+    if (d->prev!=NULL)
+        d->prev->next=d->next;
+    else
+        *list=d->next;
+    if (d->next!=NULL)
+        d->next->prev=d->prev;
+    d->prev=NULL;
+    d->next=NULL;
+}
+
+static cwalkdir *walkdir_alloc(char *relpath)
+{
+    cwalkdir *d;
+    
+    if ((d=malloc(sizeof(cwalkdir)))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)sizeof(cwalkdir));
+        return NULL;
+    }
+    memset(d, 0, sizeof(cwalkdir));
+    if ((d->relpath=strdup(relpath))==NULL)
+    {   errprintf("strdup(%s) failed: out of memory\n", relpath);
+        free(d);
+        return NULL;
+    }
+    d->status=WALKDIR_STATUS_TODO;
+    return d;
+}
+
+static void walkdir_free(cwalkdir *d)
+{
+    u32 i;
+    
+    for (i=0; i < d->count; i++)
+        free(d->entries[i].name);
+    free(d->entries);
+    free(d->relpath);
+    free(d);
+}
+
+// layout of the records returned by the getdents64 system call
+struct s_dirent64
+{   u64                  d_ino;
+    s64                  d_off;
+    unsigned short       d_reclen;
+    unsigned char        d_type;
+    char                 d_name[];
+};
+
+// lstat64() of a name relative to a directory: statx() only asks for the attributes which are saved
+static int dirwalk_stat(int dirfd, char *name, struct stat64 *statbuf)
+{
+#ifdef HAVE_STATX
+    struct statx stx;
+    
+    if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT, FSA_WALKER_STATXMASK, &stx)==0)
+    {   memset(statbuf, 0, sizeof(struct stat64));
+        statbuf->st_dev=makedev(stx.stx_dev_major, stx.stx_dev_minor);
+        statbuf->st_ino=stx.stx_ino;
+        statbuf->st_mode=stx.stx_mode;
+        statbuf->st_nlink=stx.stx_nlink;
+        statbuf->st_uid=stx.stx_uid;
+        statbuf->st_gid=stx.stx_gid;
+        statbuf->st_rdev=makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+        statbuf->st_size=stx.stx_size;
+        statbuf->st_blksize=stx.stx_blksize;
+        statbuf->st_blocks=stx.stx_blocks;
+        statbuf->st_atim.tv_sec=stx.stx_atime.tv_sec;
+        statbuf->st_atim.tv_nsec=stx.stx_atime.tv_nsec;
+        statbuf->st_mtim.tv_sec=stx.stx_mtime.tv_sec;
+        statbuf->st_mtim.tv_nsec=stx.stx_mtime.tv_nsec;
+        return 0;
+    }
+    else if (errno!=ENOSYS) // the kernel is older than linux-4.11 if statx() is not implemented
+    {   return -1;
+    }
+#endif // HAVE_STATX
+    return fstatat64(dirfd, name, statbuf, AT_SYMLINK_NOFOLLOW);
+}
+
+// physical address of the first extent of a regular file or zero if the filesystem does not support FIEMAP
+static u64 dirwalk_first_extent(int dirfd, char *name)
+{
+    char buffer[sizeof(struct fiemap)+sizeof(struct fiemap_extent)];
+    struct fiemap *fiemap=(struct fiemap *)buffer;
+    u64 physaddr=0;
+    int fd;
+    
+    if ((fd=openat(dirfd, name, O_RDONLY|O_LARGEFILE|O_NOFOLLOW))<0)
+        return 0;
+    
+    memset(buffer, 0, sizeof(buffer));
+    fiemap->fm_start=0;
+    fiemap->fm_length=FIEMAP_MAX_OFFSET;
+    fiemap->fm_extent_count=1;
+    if ((ioctl(fd, FS_IOC_FIEMAP, fiemap)==0) && (fiemap->fm_mapped_extents>0))
+        physaddr=fiemap->fm_extents[0].fe_physical;
+    
+    close(fd);
+    return physaddr;
+}
+
+static int dirwalk_compare_inodes(const void *a, const void *b)
+{
+    const cwalkent *enta=a;
+    const cwalkent *entb=b;
+    
+    if (enta->statbuf.st_ino!=entb->statbuf.st_ino)
+        return (enta->statbuf.st_ino < entb->statbuf.st_ino)?-1:1;
+    return 0;
+}
+
+static int dirwalk_compare_extents(const void *a, const void *b)
+{
+    const cwalkent *enta=a;
+    const cwalkent *entb=b;
+    
+    if (enta->physaddr!=entb->physaddr)
+        return (enta->physaddr < entb->physaddr)?-1:1;
+    return 0;
+}
+
+// option -O: the large files of each window of consecutive entries are swapped so that their data are read
+// in the order of their physical address, the other entries keep their place (inode order)
+static void dirwalk_sort_extents(cwalkdir *d)
+{
+    cwalkent window[FSA_DISKORDER_WINDOW];
+    u32 slots[FSA_DISKORDER_WINDOW];
+    u32 count;
+    u32 first;
+    u32 i;
+    
+    for (first=0; first < d->count; first+=FSA_DISKORDER_WINDOW)
+    {
+        for (i=first, count=0; (i < d->count) && (i < first+FSA_DISKORDER_WINDOW); i++)
+        {   if (d->entries[i].physaddr>0)
+            {   slots[count]=i;
+                window[count++]=d->entries[i];
+            }
+        }
+        if (count<2)
+            continue;
+        qsort(window, count, sizeof(cwalkent), dirwalk_compare_extents);
+        for (i=0; i < count; i++)
+            d->entries[slots[i]]=window[i];
+    }
+}
+
+// called without the mutex: reads the entries of the directory and the attributes of every entry
+// the entries are read with a large buffer and their attributes relative to the directory (no path lookup)
+// with option -O the entries are sorted by inode before their attributes are read (see dirwalk_sort_extents())
+static void dirwalk_scan(cdirwalk *w, cwalkdir *d)
+{
+    char fulldirpath[PATH_MAX];
+    char relpath[PATH_MAX];
+    struct s_dirent64 *dent;
+    cwalkent *entries;
+    cwalkent *ent;
+    char *buffer;
+    u32 size=0;
+    long len;
+    long pos;
+    int dirfd;
+    u32 i;
+    
+    concatenate_paths(fulldirpath, sizeof(fulldirpath), w->root, d->relpath);
+    
+    errno=0;
+    if ((dirfd=open64(fulldirpath, O_RDONLY|O_DIRECTORY|O_LARGEFILE))<0)
+    {   d->opendirerr=(errno!=0)?errno:EIO;
+        return;
+    }
+    
+    if (dirwalk_stat(AT_FDCWD, fulldirpath, &d->statbuf)!=0)
+        d->staterr=(errno!=0)?errno:EIO;
+    
+    if ((buffer=malloc(FSA_WALKER_DIRBUFSIZE))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)FSA_WALKER_DIRBUFSIZE);
+        close(dirfd);
+        return;
+    }
+    
+    // 1. read the names of the entries
+    while ((get_interrupted()==false) && ((len=syscall(SYS_getdents64, dirfd, buffer, FSA_WALKER_DIRBUFSIZE))>0))
+    {
+        for (pos=0; pos < len; pos+=dent->d_reclen)
+        {
+            dent=(struct s_dirent64 *)(buffer+pos);
+            if (strcmp(dent->d_name,".")==0 || strcmp(dent->d_name,"..")==0)
+                continue; // ignore "." and ".."
+            
+            if (d->count>=size)
+            {   size=(size>0)?(size*2):64;
+                if ((entries=realloc(d->entries, size*sizeof(cwalkent)))==NULL)
+                {   errprintf("realloc(%ld) failed: out of memory\n", (long)(size*sizeof(cwalkent)));
+                    goto dirwalk_scan_attributes; // the entries which have been read are kept
+                }
+                d->entries=entries;
+            }
+            
+            ent=&d->entries[d->count];
+            memset(ent, 0, sizeof(cwalkent));
+            if ((ent->name=strdup(dent->d_name))==NULL)
+            {   errprintf("strdup(%s) failed: out of memory\n", dent->d_name);
+                goto dirwalk_scan_attributes; // the entries which have been read are kept
+            }
+            ent->statbuf.st_ino=dent->d_ino; // known before statx() so that the entries can be sorted
+            d->count++;
+        }
+    }
+    
+    if (len<0)
+        sysprintf("cannot read the entries of directory %s\n", fulldirpath);
+    
+dirwalk_scan_attributes:
+    // 2. read the attributes of the entries (in the order of the inode tables on the disk with option -O)
+    if (g_options.diskorder==true)
+        qsort(d->entries, d->count, sizeof(cwalkent), dirwalk_compare_inodes);
+    
+    for (i=0; i < d->count; i++)
+    {
+        ent=&d->entries[i];
+        errno=0;
+        if (dirwalk_stat(dirfd, ent->name, &ent->statbuf)!=0)
+        {   ent->staterr=(errno!=0)?errno:EIO;
+            continue;
+        }
+        
+        concatenate_paths(relpath, sizeof(relpath), d->relpath, ent->name);
+        ent->excluded=((exclude_check(&g_options.exclude, ent->name)==true) || (exclude_check(&g_options.exclude, relpath)==true));
+        
+        if ((ent->excluded==false) && S_ISDIR(ent->statbuf.st_mode))
+            ent->subdir=walkdir_alloc(relpath);
+        
+        if ((ent->excluded==false) && (g_options.diskorder==true) && S_ISREG(ent->statbuf.st_mode) && (ent->statbuf.st_size>=g_options.smallfilethresh))
+            ent->physaddr=dirwalk_first_extent(dirfd, ent->name);
+    }
+    
+    // 3. read the data of the large files in the order of their physical address
+    if (g_options.diskorder==true)
+        dirwalk_sort_extents(d);
+    
+    free(buffer);
+    close(dirfd);
+}
+
+// called with the mutex locked when a directory has been scanned
+static void dirwalk_scanned(cdirwalk *w, cwalkdir *d)
+{
+    u32 i;
+    
+    d->status=WALKDIR_STATUS_DONE;
+    walkdir_list_add(&w->alive, d);
+    w->entcount+=d->count;
+    
+    for (i=d->count; i > 0; i--)
+        if (d->entries[i-1].subdir!=NULL)
+            walkdir_list_add(&w->todo, d->entries[i-1].subdir);
+    
+    pthread_cond_broadcast(&w->conddone);
+    pthread_cond_broadcast(&w->condwork);
+}
+
+static void *dirwalk_thread(void *args)
+{
+    cdirwalk *w=(cdirwalk *)args;
+    cwalkdir *d;
+    
+    pthread_mutex_lock(&w->mutex);
+    while (true)
+    {
+        while ((w->stop==false) && ((w->todo==NULL) || (w->entcount>=w->entmax)))
+            pthread_cond_wait(&w->condwork, &w->mutex);
+        if (w->stop==true)
+            break;
+        
+        d=w->todo;
+        walkdir_list_del(&w->todo, d);
+        d->status=WALKDIR_STATUS_PROGRESS;
+        pthread_mutex_unlock(&w->mutex);
+        
+        dirwalk_scan(w, d);
+        
+        pthread_mutex_lock(&w->mutex);
+        dirwalk_scanned(w, d);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    
+    return NULL;
+}
+
+int dirwalk_init(cdirwalk *w, char *root, int threadcount, u64 entmax)
+{
+    int i;
+    
+    assert(w);
+    
+    memset(w, 0, sizeof(cdirwalk));
+    if ((w->root=strdup(root))==NULL)
+    {   errprintf("strdup(%s) failed: out of memory\n", root);
+        return -1;
+    }
+    w->entmax=entmax;
+    pthread_mutex_init(&w->mutex, NULL);
+    pthread_cond_init(&w->condwork, NULL);
+    pthread_cond_init(&w->conddone, NULL);
+    
+    if ((threadcount>0) && ((w->threads=malloc(threadcount*sizeof(pthread_t)))==NULL))
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)(threadcount*sizeof(pthread_t)));
+        threadcount=0;
+    }
+    
+    // the main thread scans the directories itself if the threads cannot be created
+    for (i=0; i < threadcount; i++)
+    {   if (pthread_create(&w->threads[i], NULL, dirwalk_thread, (void*)w)!=0)
+        {   errprintf("pthread_create(dirwalk_thread) failed\n");
+            break;
+        }
+        w->threadcount++;
+    }
+    
+    return 0;
+}
+
+int dirwalk_destroy(cdirwalk *w)
+{
+    cwalkdir *d;
+    int i;
+    
+    assert(w);
+    
+    pthread_mutex_lock(&w->mutex);
+    w->stop=true;
+    pthread_cond_broadcast(&w->condwork);
+    pthread_mutex_unlock(&w->mutex);
+    
+    for (i=0; i < w->threadcount; i++)
+        pthread_join(w->threads[i], NULL);
+    
+    // directories which have not been released when the walk has been interrupted
+    while ((d=w->todo)!=NULL)
+    {   walkdir_list_del(&w->todo, d);
+        walkdir_free(d);
+    }
+    while ((d=w->alive)!=NULL)
+    {   walkdir_list_del(&w->alive, d);
+        walkdir_free(d);
+    }
+    
+    pthread_cond_destroy(&w->condwork);
+    pthread_cond_destroy(&w->conddone);
+    pthread_mutex_destroy(&w->mutex);
+    free(w->threads);
+    free(w->root);
+    return 0;
+}
+
+cwalkdir *dirwalk_add_root(cdirwalk *w, char *relpath)
+{
+    cwalkdir *d;
+    
+    assert(w);
+    
+    if ((d=walkdir_alloc(relpath))==NULL)
+        return NULL;
+    
+    pthread_mutex_lock(&w->mutex);
+    walkdir_list_add(&w->todo, d);
+    pthread_cond_broadcast(&w->condwork);
+    pthread_mutex_unlock(&w->mutex);
+    
+    return d;
+}
+
+// returns when the directory has been scanned: the main thread scans it itself if no thread has started it
+int dirwalk_wait_dir(cdirwalk *w, cwalkdir *d)
+{
+    assert(w);
+    assert(d);
+    
+    pthread_mutex_lock(&w->mutex);
+    if (d->status==WALKDIR_STATUS_TODO)
+    {
+        walkdir_list_del(&w->todo, d);
+        d->status=WALKDIR_STATUS_PROGRESS;
+        pthread_mutex_unlock(&w->mutex);
+        
+        dirwalk_scan(w, d);
+        
+        pthread_mutex_lock(&w->mutex);
+        dirwalk_scanned(w, d);
+    }
+    else
+    {
+        while (d->status!=WALKDIR_STATUS_DONE)
+            pthread_cond_wait(&w->conddone, &w->mutex);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    
+    return 0;
+}
+
+// the main thread has saved the entries of the directory: the walker threads can scan more directories
+int dirwalk_release_dir(cdirwalk *w, cwalkdir *d)
+{
+    assert(w);
+    assert(d);
+    
+    pthread_mutex_lock(&w->mutex);
+    walkdir_list_del(&w->alive, d);
+    w->entcount-=d->count;
+    pthread_cond_broadcast(&w->condwork);
+    pthread_mutex_unlock(&w->mutex);
+    
+    walkdir_free(d);
+    return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __DIRWALK_H__
+#define __DIRWALK_H__
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "types.h"
+
+enum {WALKDIR_STATUS_TODO=0, WALKDIR_STATUS_PROGRESS, WALKDIR_STATUS_DONE};
+
+struct s_walkent;
+typedef struct s_walkent cwalkent;
+
+struct s_walkdir;
+typedef struct s_walkdir cwalkdir;
+
+struct s_dirwalk;
+typedef struct s_dirwalk cdirwalk;
+
+struct s_walkent // an entry of a directory as it has been found by getdents64()
+{   char                 *name; // name of the entry in its directory
+    struct stat64        statbuf; // result of lstat64() on the entry
+    int                  staterr; // errno set by lstat64() or zero if it worked
+    bool                 excluded; // true if the entry matches a pattern of option --exclude
+    u64                  physaddr; // physical address of the data of large files with option -O (or zero)
+    cwalkdir             *subdir; // contents of the entry when it's a directory which is not excluded
+};
+
+struct s_walkdir // a directory which has to be scanned or which has been scanned by the walker threads
+{   char                 *relpath; // path of the directory relative to the root of the walk
+    int                  status; // WALKDIR_STATUS_xxx: scanned, being scanned, not yet scanned
+    int                  opendirerr; // errno set by opendir() or zero if it worked
+    int                  staterr; // errno set by lstat64() on the directory itself or zero if it worked
+    struct stat64        statbuf; // result of lstat64() on the directory itself
+    cwalkent             *entries; // entries of the directory in the order of getdents64() or in disk order (option -O)
+    u32                  count; // how many entries there are
+    cwalkdir             *prev; // previous directory in the list (todo list or list of scanned directories)
+    cwalkdir             *next; // next directory in the list (todo list or list of scanned directories)
+};
+
+struct s_dirwalk // pool of threads which scan the directories before the main thread needs them
+{   char                 *root; // the paths of the directories are relative to that directory
+    pthread_t            *threads; // the walker threads
+    int                  threadcount; // how many walker threads have been created
+    pthread_mutex_t      mutex; // protects all the fields below
+    pthread_cond_t       condwork; // signaled when a directory can be scanned or when the threads must exit
+    pthread_cond_t       conddone; // signaled when a directory has been scanned
+    cwalkdir             *todo; // directories to scan: the first is the next one the main thread will need
+    cwalkdir             *alive; // directories which are not in the todo list and which have not been released
+    u64                  entcount; // how many entries have been scanned and not yet released by the main thread
+    u64                  entmax; // the threads wait when there are more entries than that
+    bool                 stop; // true when the threads must exit
+};
+
+int      dirwalk_init(cdirwalk *w, char *root, int threadcount, u64 entmax);
+int      dirwalk_destroy(cdirwalk *w);
+cwalkdir *dirwalk_add_root(cdirwalk *w, char *relpath);
+int      dirwalk_wait_dir(cdirwalk *w, cwalkdir *d);
+int      dirwalk_release_dir(cdirwalk *w, cwalkdir *d);
+
+#endif // __DIRWALK_H__
@@ -161,7 +161,7 @@ int btrfs_getinfo(cdico *d, char *devname)
     }
     
     // ---- minimum fsarchiver version required to restore
-    dico_add_u64(d, 0, FSYSHEADKEY_MINFSAVERSION, FSA_VERSION_BUILD(0, 6, 4, 0));
+    dico_add_u64(d, 0, FSYSHEADKEY_MINFSAVERSION, FSA_VERSION_MINRESTORE);
     
 btrfs_read_sb_close:
     close(fd);
@@ -29,6 +29,8 @@
 #include "fsarchiver.h"
 #include "dico.h"
 #include "common.h"
+#include "checksum.h"
+#include "zeroblock.h"
 #include "oper_restore.h"
 #include "oper_save.h"
 #include "oper_probe.h"
@@ -40,14 +42,16 @@
 #include "logfile.h"
 #include "error.h"
 #include "queue.h"
+#include "blkpool.h"
+#include "compdict.h"
 
 char *valid_magic[]={FSA_MAGIC_MAIN, FSA_MAGIC_VOLH, FSA_MAGIC_VOLF, 
     FSA_MAGIC_FSIN, FSA_MAGIC_FSYB, FSA_MAGIC_DATF, FSA_MAGIC_OBJT, 
-    FSA_MAGIC_BLKH, FSA_MAGIC_FILF, FSA_MAGIC_DIRS, NULL};
+    FSA_MAGIC_BLKH, FSA_MAGIC_FILF, FSA_MAGIC_DIRS, FSA_MAGIC_DICT, NULL};
 
 void usage(char *progname, bool examples)
 {
-    int lzo=false, lzma=false;
+    int lzo=false, lzma=false, zstd=false, lz4=false;
     
 #ifdef OPTION_LZO_SUPPORT
     lzo=true;
@@ -55,6 +59,12 @@ void usage(char *progname, bool examples)
 #ifdef OPTION_LZMA_SUPPORT
     lzma=true;
 #endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+    zstd=true;
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+    lz4=true;
+#endif // OPTION_LZ4_SUPPORT
     
     msgprintf(MSG_FORCE, "====> fsarchiver version %s (%s) - http://www.fsarchiver.org <====\n", FSA_VERSION, FSA_RELDATE);
     msgprintf(MSG_FORCE, "Distributed under the GPL v2 license (GNU General Public License v2).\n");
@@ -73,15 +83,24 @@ void usage(char *progname, bool examples)
     msgprintf(MSG_FORCE, " -A: allow to save a filesystem which is mounted in read-write (live backup)\n");
     msgprintf(MSG_FORCE, " -a: allow running savefs when partition mounted without the acl/xattr options\n");
     msgprintf(MSG_FORCE, " -e <pattern>: exclude files and directories that match that pattern\n");
+    msgprintf(MSG_FORCE, " -O: read the files in the order of the inodes and data on the disk (hard disks)\n");
     msgprintf(MSG_FORCE, " -L <label>: set the label of the archive (comment about the contents)\n");
     msgprintf(MSG_FORCE, " -z <level>: compression level from 1 (very fast)  to  9 (very good) default=3\n");
+    msgprintf(MSG_FORCE, " -z auto: adapt the compression level to the speed of the disks while saving\n");
+    msgprintf(MSG_FORCE, " -t: store media/archives, compress text/databases more and disk images less\n");
+    msgprintf(MSG_FORCE, " -D: compress small files with a dictionary built from samples (gzip/zstd)\n");
+    msgprintf(MSG_FORCE, " -Z <level>: zstd compression level from 1 (very fast) to 22 (very good)\n");
+    msgprintf(MSG_FORCE, " -l <level>: lz4 compression level from 1 (fastest) to 12 (lz4-hc from level 3)\n");
+    msgprintf(MSG_FORCE, " -g <count>: compress up to <count> consecutive blocks as one stream (lzma/zstd)\n");
     msgprintf(MSG_FORCE, " -s <mbsize>: split the archive into several files of <mbsize> megabytes each\n");
     msgprintf(MSG_FORCE, " -j <count>: create more than one compression thread. useful on multi-core cpu\n");
+    msgprintf(MSG_FORCE, " -m <mbsize>: max memory used by the data blocks being processed, in megabytes\n");
     msgprintf(MSG_FORCE, " -c <password>: encrypt/decrypt data in archive, \"-c -\" for interactive password\n");
+    msgprintf(MSG_FORCE, " -k <algo>: checksum of the blocks: crc32c (default) or fletcher32\n");
     msgprintf(MSG_FORCE, " -h: show help and information about how to use fsarchiver with examples\n");
     msgprintf(MSG_FORCE, " -V: show program version and exit\n");
     msgprintf(MSG_FORCE, "<information>\n");
-    msgprintf(MSG_FORCE, " * Support included for: lzo=%s, lzma=%s\n", (lzo==true)?"yes":"no", (lzma==true)?"yes":"no");
+    msgprintf(MSG_FORCE, " * Support included for: lzo=%s, lzma=%s, zstd=%s, lz4=%s\n", (lzo==true)?"yes":"no", (lzma==true)?"yes":"no", (zstd==true)?"yes":"no", (lz4==true)?"yes":"no");
     msgprintf(MSG_FORCE, " * support for ntfs filesystems is unstable: don't use it for production.\n");
     
     if (examples==true)
@@ -128,11 +147,19 @@ static struct option const long_options[] =
     {"verbose", no_argument, NULL, 'v'},
     {"debug", no_argument, NULL, 'd'},
     {"compress", required_argument, NULL, 'z'},
+    {"zstd", required_argument, NULL, 'Z'},
+    {"lz4", required_argument, NULL, 'l'},
+    {"type-policy", no_argument, NULL, 't'},
+    {"dictionary", no_argument, NULL, 'D'},
+    {"disk-order", no_argument, NULL, 'O'},
+    {"solid", required_argument, NULL, 'g'},
     {"jobs", required_argument, NULL, 'j'},
+    {"max-memory", required_argument, NULL, 'm'},
     {"help", no_argument, NULL, 'h'},
     {"version", no_argument, NULL, 'V'},
     {"split", required_argument, NULL, 's'},
     {"cryptpass", required_argument, NULL, 'c'},
+    {"checksum", required_argument, NULL, 'k'},
     {"label", required_argument, NULL, 'L'},
     {"exclude", required_argument, NULL, 'e'},
     {NULL, 0, NULL, 0}
@@ -148,7 +175,9 @@ int process_cmdline(int argc, char **argv)
     char *command=NULL;
     char *archive=NULL;
     char tempbuf[1024];
+    unsigned long long mbsize;
     char *progname;
+    char *endptr;
     int fscount;
     int argcok;
     int ret=0;
@@ -171,10 +200,11 @@ int process_cmdline(int argc, char **argv)
     g_options.compresslevel=FSA_DEF_COMPRESS_LEVEL; // default level for gzip
     g_options.datablocksize=FSA_DEF_BLKSIZE;
     g_options.encryptalgo=ENCRYPT_NONE;
+    g_options.csumalgo=CSUMALGO_CRC32C;
     snprintf(g_options.archlabel, sizeof(g_options.archlabel), "<none>");
     g_options.encryptpass[0]=0;
     
-    while ((c = getopt_long(argc, argv, "oaAvdz:j:hVs:c:L:e:", long_options, NULL)) != EOF)
+    while ((c = getopt_long(argc, argv, "oaAvdtDOz:Z:l:g:j:m:hVs:c:k:L:e:", long_options, NULL)) != EOF)
     {
         switch (c)
         {
@@ -205,6 +235,17 @@ int process_cmdline(int argc, char **argv)
                     return 1;
                 }
                 break;
+            case 'm': // memory budget of the queue
+                mbsize=strtoull(optarg, &endptr, 10);
+                if ((optarg[0]<'0') || (optarg[0]>'9') || (*endptr!=0) || (mbsize==0)
+                    || (mbsize>((u64)-1)/((u64)1024LL*1024LL)))
+                {
+                    errprintf("argument of option -m is invalid (%s). It must be a positive number of megabytes\n", optarg);
+                    usage(progname, false);
+                    return 1;
+                }
+                g_options.maxmemory=((u64)mbsize)*((u64)1024LL*1024LL);
+                break;
             case 'e': // exclude files/directories
                 strlist_add(&g_options.exclude, optarg);
                 break;
@@ -223,6 +264,11 @@ int process_cmdline(int argc, char **argv)
                 }
                 break;
             case 'z': // compression level
+                if (strcmp(optarg, "auto")==0)
+                {   if (options_select_auto_level()<0)
+                        return -1;
+                    break;
+                }
                 g_options.fsacomplevel=atoi(optarg);
                 if (g_options.fsacomplevel<1 || g_options.fsacomplevel>9)
                 {   errprintf("[%s] is not a valid compression level, it must be an integer between 1 and 9.\n", optarg);
@@ -235,8 +281,38 @@ int process_cmdline(int argc, char **argv)
                     msgprintf(MSG_FORCE, "Compression levels >= 8 may require a huge amount of memory\n"
                         "Please read the man page or \"http://www.fsarchiver.org/Compression\" for more details.\n");
                 break;
+            case 'Z': // zstd compression level
+                if (options_select_zstd_level(atoi(optarg))<0)
+                {   usage(progname, false);
+                    return -1;
+                }
+                break;
+            case 'D': // compress small files with a dictionary
+                g_options.compressdict=true;
+                break;
+            case 'O': // read the files in the order of the disk
+                g_options.diskorder=true;
+                break;
+            case 't': // compression depends on the type of the files
+                if (options_enable_comp_policy()<0)
+                    return -1;
+                break;
+            case 'l': // lz4 compression level
+                if (options_select_lz4_level(atoi(optarg))<0)
+                {   usage(progname, false);
+                    return -1;
+                }
+                break;
+            case 'g': // solid groups of blocks
+                g_options.solidblocks=atoi(optarg);
+                if (g_options.solidblocks<2 || g_options.solidblocks>FSA_MAX_SOLIDBLOCKS)
+                {   errprintf("[%s] is not a valid number of blocks per group. Must be between 2 and %d\n", optarg, FSA_MAX_SOLIDBLOCKS);
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
             case 'c': // encryption
-                g_options.encryptalgo=ENCRYPT_BLOWFISH;
+                g_options.encryptalgo=ENCRYPT_AES256GCM;
                 if ((strlen(optarg)<FSA_MIN_PASSLEN || strlen(optarg)>FSA_MAX_PASSLEN) && strcmp(optarg, "-")!=0)
                 {   errprintf("the password lenght is incorrect, it must between %d and %d chars, or \"-\" for interactive password prompt.\n", FSA_MIN_PASSLEN, FSA_MAX_PASSLEN);
                     usage(progname, false);
@@ -244,6 +320,17 @@ int process_cmdline(int argc, char **argv)
                 }
                 snprintf((char*)g_options.encryptpass, FSA_MAX_PASSLEN, "%s", optarg);
                 break;
+            case 'k': // checksum of the blocks
+                if (strcmp(optarg, "crc32c")==0)
+                    g_options.csumalgo=CSUMALGO_CRC32C;
+                else if (strcmp(optarg, "fletcher32")==0)
+                    g_options.csumalgo=CSUMALGO_FLETCHER32;
+                else
+                {   errprintf("[%s] is not a valid checksum algorithm. Must be crc32c or fletcher32\n", optarg);
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
             case 'L': // archive label
                 snprintf(g_options.archlabel, sizeof(g_options.archlabel), "%s", optarg);
                 break;
@@ -435,15 +522,23 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
     
+    // select the fastest checksum and zero detection functions for this cpu
+    checksum_init();
+    zeroblock_init();
+    
     // init
     options_init();
-    queue_init(&g_queue, FSA_MAX_QUEUESIZE);
+    queue_init(&g_queue, FSA_DEF_MAXMEMORY);
+    blkpool_init();
+    compdict_init();
     
     // bulk of the program
     ret=process_cmdline(argc, argv);
 
     // cleanup
     queue_destroy(&g_queue);
+    blkpool_destroy();
+    compdict_destroy();
     options_destroy();
     
     // cleanup libgcrypt
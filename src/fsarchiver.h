@@ -44,8 +44,10 @@ enum {VOLUMEHEADKEY_VOLNUM, VOLUMEHEADKEY_ARCHID, VOLUMEHEADKEY_FILEFORMATVER, V
 enum {VOLUMEFOOTKEY_VOLNUM, VOLUMEFOOTKEY_ARCHID, VOLUMEFOOTKEY_LASTVOL};
 
 // ----------------------------------- algorithms used to process data-------------------------------
-enum {COMPRESS_NULL=0, COMPRESS_NONE, COMPRESS_LZO, COMPRESS_GZIP, COMPRESS_BZIP2, COMPRESS_LZMA};
-enum {ENCRYPT_NULL=0, ENCRYPT_NONE, ENCRYPT_BLOWFISH};
+enum {COMPRESS_NULL=0, COMPRESS_NONE, COMPRESS_LZO, COMPRESS_GZIP, COMPRESS_BZIP2, COMPRESS_LZMA, COMPRESS_ZSTD, COMPRESS_LZ4, 
+      COMPRESS_GZIPDICT, COMPRESS_ZSTDDICT, COMPRESS_LZMASOLID, COMPRESS_ZSTDSOLID};
+enum {ENCRYPT_NULL=0, ENCRYPT_NONE, ENCRYPT_BLOWFISH, ENCRYPT_AES256GCM};
+enum {CSUMALGO_NULL=0, CSUMALGO_FLETCHER32, CSUMALGO_CRC32C};
 
 // ----------------------------------- dico keys ----------------------------------------------------
 enum {OBJTYPE_NULL=0, OBJTYPE_DIR, OBJTYPE_SYMLINK, OBJTYPE_HARDLINK, OBJTYPE_CHARDEV, 
@@ -55,19 +57,21 @@ enum {DISKITEMKEY_NULL=0, DISKITEMKEY_OBJECTID, DISKITEMKEY_PATH, DISKITEMKEY_OB
       DISKITEMKEY_SYMLINK, DISKITEMKEY_HARDLINK, DISKITEMKEY_RDEV, DISKITEMKEY_MODE, 
       DISKITEMKEY_SIZE, DISKITEMKEY_UID, DISKITEMKEY_GID, DISKITEMKEY_ATIME, DISKITEMKEY_MTIME,
       DISKITEMKEY_MD5SUM, DISKITEMKEY_MULTIFILESCOUNT, DISKITEMKEY_MULTIFILESOFFSET,
-      DISKITEMKEY_LINKTARGETTYPE, DISKITEMKEY_FLAGS};
+      DISKITEMKEY_LINKTARGETTYPE, DISKITEMKEY_FLAGS, DISKITEMKEY_EXTENTS};
 
 enum {BLOCKHEADITEMKEY_NULL=0, BLOCKHEADITEMKEY_REALSIZE, BLOCKHEADITEMKEY_BLOCKOFFSET, 
       BLOCKHEADITEMKEY_COMPRESSALGO, BLOCKHEADITEMKEY_ENCRYPTALGO, BLOCKHEADITEMKEY_ARSIZE, 
-      BLOCKHEADITEMKEY_COMPSIZE, BLOCKHEADITEMKEY_ARCSUM};
+      BLOCKHEADITEMKEY_COMPSIZE, BLOCKHEADITEMKEY_ARCSUM, BLOCKHEADITEMKEY_GROUPID, BLOCKHEADITEMKEY_GROUPPOS,
+      BLOCKHEADITEMKEY_CRYPTNONCE, BLOCKHEADITEMKEY_ARCRC32C, BLOCKHEADITEMKEY_DATAMD5, BLOCKHEADITEMKEY_ZEROBLOCK};
 
-enum {BLOCKFOOTITEMKEY_NULL=0, BLOCKFOOTITEMKEY_MD5SUM};
+enum {BLOCKFOOTITEMKEY_NULL=0, BLOCKFOOTITEMKEY_MD5SUM, BLOCKFOOTITEMKEY_DATAMD5};
 
 enum {MAINHEADKEY_NULL=0, MAINHEADKEY_FILEFORMATVER, MAINHEADKEY_PROGVERCREAT, MAINHEADKEY_ARCHIVEID, 
       MAINHEADKEY_CREATTIME, MAINHEADKEY_ARCHLABEL, MAINHEADKEY_ARCHTYPE, MAINHEADKEY_FSCOUNT, 
       MAINHEADKEY_COMPRESSALGO, MAINHEADKEY_COMPRESSLEVEL, MAINHEADKEY_ENCRYPTALGO, 
       MAINHEADKEY_BUFCHECKPASSCLEARMD5, MAINHEADKEY_BUFCHECKPASSCRYPTBUF, MAINHEADKEY_FSACOMPLEVEL,
-      MAINHEADKEY_MINFSAVERSION, MAINHEADKEY_HASDIRSINFOHEAD};
+      MAINHEADKEY_MINFSAVERSION, MAINHEADKEY_HASDIRSINFOHEAD, MAINHEADKEY_CRYPTSALT,
+      MAINHEADKEY_CRYPTKDFITER};
 
 enum {FSYSHEADKEY_NULL=0, FSYSHEADKEY_FILESYSTEM, FSYSHEADKEY_MNTPATH, FSYSHEADKEY_BYTESTOTAL, 
       FSYSHEADKEY_BYTESUSED, FSYSHEADKEY_FSLABEL, FSYSHEADKEY_FSUUID, FSYSHEADKEY_FSINODESIZE, 
@@ -85,6 +89,8 @@ enum {FSYSHEADKEY_NULL=0, FSYSHEADKEY_FILESYSTEM, FSYSHEADKEY_MNTPATH, FSYSHEADK
 
 enum {DIRSINFOKEY_NULL=0, DIRSINFOKEY_TOTALCOST};
 
+enum {DICTHEADKEY_NULL=0, DICTHEADKEY_DATA};
+
 // -------------------------------- fsarchiver errors ---------------------------------------------
 enum {FSAERR_SUCCESS=0,           // success
       FSAERR_UNKNOWN=-1,          // uknown error (default code that means error)
@@ -109,7 +115,7 @@ enum {OLDERR_FATAL=1,
 #define FSA_RELDATE              PACKAGE_RELDATE
 #define FSA_FILEFORMAT           PACKAGE_FILEFMT
 
-#define FSA_GCRYPT_VERSION       "1.2.3"
+#define FSA_GCRYPT_VERSION       "1.6.0"
 
 #define FSA_MAX_FILEFMTLEN       32
 #define FSA_MAX_PROGVERLEN       32
@@ -119,10 +125,21 @@ enum {OLDERR_FATAL=1,
 #define FSA_MAX_BLKDEVICES       256
 
 #define FSA_MAX_FSPERARCH        128
-#define FSA_MAX_COMPJOBS         32
-#define FSA_MAX_QUEUESIZE        32
+#define FSA_MAX_COMPJOBS         128            // each compression thread has its own list of blocks to process
+#define FSA_DEF_MAXMEMORY        (64LL*1024LL*1024LL) // default memory budget of the queue (option --max-memory)
+#define FSA_DEF_MEMPERJOB        (4LL*1024LL*1024LL) // the default budget is at least that much per compression thread
+#define FSA_MAX_QUEUEITEMS       4096           // max number of items (headers + blocks) in the queue: must be a power of two
+#define FSA_WALKER_THREADS       4              // threads which scan the directories before the main thread saves them
+#define FSA_WALKER_MAXENTRIES    65536          // the walker threads wait when that many entries are waiting to be saved
+#define FSA_DISKORDER_WINDOW     64             // option -O: large files are read in disk order within that many entries
+#define FSA_WALKER_DIRBUFSIZE    131072         // size of the buffer used to read the entries of a directory with getdents64
+#define FSA_WALKER_STATXMASK     (STATX_TYPE|STATX_MODE|STATX_NLINK|STATX_UID|STATX_GID|STATX_ATIME|STATX_MTIME|STATX_INO|STATX_SIZE|STATX_BLOCKS)
+#define FSA_READER_THREADS       4              // threads which read the large and the small files before the main thread queues them
+#define FSA_READER_DEPTH         16             // how many blocks of a large file can be read in advance by the reader threads
+#define FSA_READER_FILES         128            // how many small files of a directory can be read in advance by the reader threads
 #define FSA_MAX_BLKSIZE          921600
 #define FSA_DEF_BLKSIZE          262144
+#define FSA_MAX_SOLIDBLOCKS      64             // max number of consecutive blocks compressed as one stream (option -g)
 #define FSA_DEF_COMPRESS_ALGO    COMPRESS_GZIP  // compress using gzip by default
 #define FSA_DEF_COMPRESS_LEVEL   6              // compress with "gzip -6" by default
 #define FSA_MAX_SMALLFILECOUNT   512            // there can be up to FSA_MAX_SMALLFILECOUNT files copied in a single data block 
@@ -137,6 +154,7 @@ enum {OLDERR_FATAL=1,
 #define FSA_CHECKPASSBUF_SIZE    4096
 
 #define FSA_FILEFLAGS_SPARSE     1<<0           // set when a regfile is a sparse file
+#define FSA_MAX_EXTENTS          4000           // max number of extents of data of a sparse file in its header (64k)
 
 // ----------------------------- fsarchiver magics --------------------------------------------------
 #define FSA_SIZEOF_MAGIC         4
@@ -149,6 +167,7 @@ enum {OLDERR_FATAL=1,
 #define FSA_MAGIC_OBJT           "ObJt" // object header (one per object: regfiles, dirs, symlinks, ...)
 #define FSA_MAGIC_BLKH           "BlKh" // datablk header (one per data block, each regfile may have [0-n])
 #define FSA_MAGIC_FILF           "FiLf" // filedat footer (one per regfile, after the list of data blocks)
+#define FSA_MAGIC_DICT           "DiCt" // dictionary used to compress the blocks of small files (one per archive before the contents)
 #define FSA_MAGIC_DATF           "DaEn" // data footer (one per file system, at the end of its contents, or after the contents of the flatfiles)
 
 // ------------ global variables ---------------------------
@@ -161,4 +180,7 @@ extern char *valid_magic[];
 #define FSA_VERSION_GET_C(ver)            ((((u64)ver)>>16)&0xFFFF)
 #define FSA_VERSION_GET_D(ver)            ((((u64)ver)>>0)&0xFFFF)
 
+// oldest version which can restore the archives written by this version (written in the main and filesystem headers)
+#define FSA_VERSION_MINRESTORE            FSA_VERSION_BUILD(0, 6, 18, 0)
+
 #endif // __FSARCHIVER_H__
@@ -53,6 +53,7 @@
 #include "error.h"
 #include "datafile.h"
 #include "queue.h"
+#include "blkpool.h"
 
 typedef struct s_extractar
 {   carchreader ai;
@@ -593,6 +594,7 @@ int extractar_restore_obj_regfile_multi(cextractar *exar, char *destdir, cdico *
     cregmulti regmulti;
     u8 md5sumcalc[16];
     u8 md5sumorig[16];
+    bool corrupt;
     int errors;
     u32 filescount;
     u32 tmpobjtype;
@@ -644,7 +646,7 @@ int extractar_restore_obj_regfile_multi(cextractar *exar, char *destdir, cdico *
     {   errprintf("regmulti_rest_setdatablock() failed\n");
         return -1;
     }
-    free(blkinfo.blkdata); // free memory allocated by the thread_io_reader
+    blkpool_free(blkinfo.blkdata); // free memory allocated by the thread_io_reader
     
     // ---- create the set of small files using the regmulti structure
     for (i=0; i < filescount; i++)
@@ -685,7 +687,16 @@ int extractar_restore_obj_regfile_multi(cextractar *exar, char *destdir, cdico *
             
             extractar_listing_print_file(exar, tmpobjtype, relpath);
             
-            if (dico_get_data(filehead, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_MD5SUM, md5sumorig, 16, NULL))
+            // archives written by older versions have the md5 of each small file in its header, and the
+            // md5 of the shared block has already been checked by the compression thread in newer ones
+            if (dico_get_data(filehead, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_MD5SUM, md5sumorig, 16, NULL)==0)
+            {   gcry_md_hash_buffer(GCRY_MD_MD5, md5sumcalc, databuf, datsize);
+                corrupt=(memcmp(md5sumcalc, md5sumorig, 16)!=0);
+            }
+            else if (blkinfo.blkhasdatamd5==true)
+            {   corrupt=blkinfo.blkdatacorrupt;
+            }
+            else
             {   errprintf("cannot get md5sum from file footer for file=[%s]\n", relpath);
                 dico_show(filehead, DICO_OBJ_SECTION_STDATTR, "filehead");
                 goto extractar_restore_obj_regfile_multi_err;
@@ -696,7 +707,7 @@ int extractar_restore_obj_regfile_multi(cextractar *exar, char *destdir, cdico *
             
             res=datafile_write(datafile, databuf, datsize);
             
-            datafile_close(datafile, md5sumcalc, sizeof(md5sumcalc));
+            datafile_close(datafile);
             
             if (res!=FSAERR_SUCCESS)
             {   errprintf("removing %s\n", fullpath);
@@ -704,7 +715,7 @@ int extractar_restore_obj_regfile_multi(cextractar *exar, char *destdir, cdico *
                 return -1;
             }
             
-            if (memcmp(md5sumcalc, md5sumorig, 16)!=0)
+            if (corrupt==true)
             {   errprintf("cannot restore file %s, the data block (which is shared by multiple files) is corrupt\n", relpath);
                 res=truncate(fullpath, 0); // don't leave corrupt data in the file
                 goto extractar_restore_obj_regfile_multi_err;
@@ -743,24 +754,38 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
     char parentdir[PATH_MAX];
     cdatafile *datafile=NULL;
     cdico *footerdico=NULL;
+    gcry_md_hd_t md5ctx;
     bool fatalerr=false; // error for restoration globally
     bool minorerr=false; // error for current file only
+    bool corrupt=false; // a block does not match its md5
     bool delfile=false;
     struct timeval tv[2];
     u8 md5sumcalc[16];
     u8 md5sumorig[16];
     int excluded=false;
     bool sparse=false;
+    u64 *extents=NULL;
+    u16 extsize=0;
+    u64 extcount=0;
     u64 filesize=0;
     u64 filepos=0;
+    u64 extend;
     u64 flags=0;
     s64 lres;
+    u64 i;
     
     // init
     memset(&blkinfo, 0, sizeof(blkinfo));
     memset(magic, 0, sizeof(magic));
     datafile=datafile_alloc();
     
+    if (gcry_md_open(&md5ctx, GCRY_MD_MD5, 0)!=GPG_ERR_NO_ERROR)
+    {   errprintf("gcry_md_open() failed\n");
+        datafile_destroy(datafile);
+        dico_destroy(d);
+        return -1;
+    }
+    
     if (dico_get_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_SIZE, &filesize)!=0)
     {   errprintf("Cannot read filesize DISKITEMKEY_SIZE from archive for file=[%s]\n", relpath);
         minorerr=true;
@@ -768,6 +793,23 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
     
     sparse=((dico_get_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_FLAGS, &flags)==0) && (flags&FSA_FILEFLAGS_SPARSE));
     
+    // sparse files only have blocks for the extents of data (archives written by older versions have all the blocks)
+    if ((extents=malloc(2*FSA_MAX_EXTENTS*sizeof(u64)))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)(2*FSA_MAX_EXTENTS*sizeof(u64)));
+        minorerr=true;
+    }
+    else if (dico_get_data(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_EXTENTS, extents, 2*FSA_MAX_EXTENTS*sizeof(u64), &extsize)==0)
+    {   extcount=extsize/(2*sizeof(u64));
+        for (i=0; i < 2*extcount; i++)
+            extents[i]=le64_to_cpu(extents[i]);
+        sparse=true;
+    }
+    else
+    {   extents[0]=0;
+        extents[1]=filesize;
+        extcount=(filesize>0)?1:0;
+    }
+    
     // update cost statistics and progress bar
     exar->cost_current+=FSA_COST_PER_FILE; 
     exar->cost_current+=filesize;
@@ -794,37 +836,64 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
         minorerr=true;
     
     msgprintf(MSG_DEBUG2, "restore_obj_regfile_unique(file=%s, size=%lld)\n", relpath, (long long)filesize);
-    for (filepos=0; (minorerr==false) && (filesize>0) && (filepos < filesize) && (get_interrupted()==false); filepos+=blkinfo.blkrealsize)
+    for (i=0; (minorerr==false) && (i < extcount) && (get_interrupted()==false); i++)
     {
-        if ((lres=queue_dequeue_block(&g_queue, &blkinfo))<=0)
-        {   errprintf("queue_dequeue_block()=%ld=%s for file(%s) failed\n", (long)lres, error_int_to_string(lres), relpath);
-            delfile=true;
-            minorerr=true;
-            break;
-        }
-        
-        if (blkinfo.blkoffset!=filepos)
-        {   errprintf("file offset do not match for file(%s) failed: filepos=%lld, blkinfo.blkoffset=%lld, blkinfo.blkrealsize=%lld\n", 
-                relpath, (long long)filepos, (long long)blkinfo.blkoffset, (long long)blkinfo.blkrealsize);
-            free(blkinfo.blkdata);
-            delfile=true;
-            minorerr=true;
-            break;
-        }
-        
-        if (datafile_write(datafile, blkinfo.blkdata, blkinfo.blkrealsize)!=FSAERR_SUCCESS)
-        {   free(blkinfo.blkdata);
-            delfile=true;
+        extend=extents[2*i]+extents[2*i+1];
+        if ((extents[2*i]>0) && (datafile_seek(datafile, extents[2*i])!=FSAERR_SUCCESS))
+        {   delfile=true;
             minorerr=true;
             fatalerr=true;
             break;
         }
         
-        free(blkinfo.blkdata);
+        for (filepos=extents[2*i]; (minorerr==false) && (filepos < extend) && (get_interrupted()==false); filepos+=blkinfo.blkrealsize)
+        {
+            if ((lres=queue_dequeue_block(&g_queue, &blkinfo))<=0)
+            {   errprintf("queue_dequeue_block()=%ld=%s for file(%s) failed\n", (long)lres, error_int_to_string(lres), relpath);
+                delfile=true;
+                minorerr=true;
+                break;
+            }
+            
+            if (blkinfo.blkoffset!=filepos)
+            {   errprintf("file offset do not match for file(%s) failed: filepos=%lld, blkinfo.blkoffset=%lld, blkinfo.blkrealsize=%lld\n", 
+                    relpath, (long long)filepos, (long long)blkinfo.blkoffset, (long long)blkinfo.blkrealsize);
+                blkpool_free(blkinfo.blkdata);
+                delfile=true;
+                minorerr=true;
+                break;
+            }
+            
+            // the md5 of the blocks have been checked by the compression threads and only have to be combined
+            // here, but archives written by older versions only have the md5 of the whole file in the footer
+            if (blkinfo.blkhasdatamd5==true)
+                gcry_md_write(md5ctx, blkinfo.blkdatamd5, 16);
+            else
+                gcry_md_write(md5ctx, blkinfo.blkdata, blkinfo.blkrealsize);
+            if (blkinfo.blkdatacorrupt==true)
+                corrupt=true;
+            
+            if (datafile_write(datafile, blkinfo.blkdata, blkinfo.blkrealsize)!=FSAERR_SUCCESS)
+            {   blkpool_free(blkinfo.blkdata);
+                delfile=true;
+                minorerr=true;
+                fatalerr=true;
+                break;
+            }
+            
+            blkpool_free(blkinfo.blkdata);
+        }
+    }
+    
+    // the end of a sparse file may be a hole: datafile_close() truncates the file at the current position
+    if ((minorerr==false) && (sparse==true) && (datafile_seek(datafile, filesize)!=FSAERR_SUCCESS))
+    {   delfile=true;
+        minorerr=true;
     }
     
-    if ((minorerr==false) && (datafile_close(datafile, md5sumcalc, sizeof(md5sumcalc))!=0))
+    if ((minorerr==false) && (datafile_close(datafile)!=0))
         minorerr=true;
+    memcpy(md5sumcalc, gcry_md_read(md5ctx, GCRY_MD_MD5), 16);
     
     if ((minorerr==false) && (excluded==false))
     {
@@ -857,13 +926,14 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
                 goto restore_obj_regfile_unique_end;
             }
             
-            if (dico_get_data(footerdico, 0, BLOCKFOOTITEMKEY_MD5SUM, md5sumorig, 16, NULL))
+            if ((dico_get_data(footerdico, 0, BLOCKFOOTITEMKEY_DATAMD5, md5sumorig, 16, NULL)!=0)
+                && (dico_get_data(footerdico, 0, BLOCKFOOTITEMKEY_MD5SUM, md5sumorig, 16, NULL)!=0))
             {   errprintf("cannot get md5sum from file footer for file=[%s]\n", relpath);
                 minorerr=true;
                 goto restore_obj_regfile_unique_end;
             }
             
-            if (memcmp(md5sumcalc, md5sumorig, 16)!=0)
+            if ((corrupt==true) || (memcmp(md5sumcalc, md5sumorig, 16)!=0))
             {   errprintf("cannot restore file %s, file is corrupt\n", relpath);
                 delfile=true; // don't leave corrupt data in the file
                 minorerr=true;
@@ -889,9 +959,11 @@ restore_obj_regfile_unique_end:
     if (get_interrupted()==true)
         errprintf("operation has been interrupted\n");
 
+    gcry_md_close(md5ctx);
     dico_destroy(footerdico);
     dico_destroy(d);
     datafile_destroy(datafile);
+    free(extents);
     return (fatalerr==false)?(0):(-1);
 }
 
@@ -1039,10 +1111,15 @@ int extractar_extract_read_objects(cextractar *exar, int *errors, char *destdir,
 
 int extractar_read_mainhead(cextractar *exar, cdico **dicomainhead)
 {
-    u8 bufcheckclear[FSA_CHECKPASSBUF_SIZE+8];
-    u8 bufcheckcrypt[FSA_CHECKPASSBUF_SIZE+8];
+    u8 bufcheckclear[FSA_CHECKPASSBUF_SIZE+FSA_CRYPT_TAGSIZE];
+    u8 bufcheckcrypt[FSA_CHECKPASSBUF_SIZE+FSA_CRYPT_TAGSIZE];
     char magic[FSA_SIZEOF_MAGIC+1];
+    u8 salt[FSA_CRYPT_SALTSIZE];
+    u8 key[FSA_CRYPT_KEYSIZE];
+    ccryptctx cryptctx;
     u16 cryptbufsize;
+    u16 saltsize;
+    u32 kdfiter;
     u8 md5sumar[16];
     u8 md5sumnew[16];
     u64 clearsize;
@@ -1157,8 +1234,35 @@ int extractar_read_mainhead(cextractar *exar, cdico **dicomainhead)
             return -1;
         }
         
-        if (crypto_blowfish(cryptbufsize, &clearsize, bufcheckcrypt, bufcheckclear, g_options.encryptpass, strlen((char*)g_options.encryptpass), false)==0)
-            gcry_md_hash_buffer(GCRY_MD_MD5, md5sumnew, bufcheckclear, clearsize);
+        if (exar->ai.cryptalgo==ENCRYPT_AES256GCM) // the key is derived once and used by all the threads
+        {
+            if ((dico_get_data(*dicomainhead, 0, MAINHEADKEY_CRYPTSALT, salt, sizeof(salt), &saltsize)!=0) || 
+                (dico_get_u32(*dicomainhead, 0, MAINHEADKEY_CRYPTKDFITER, &kdfiter)!=0))
+            {   errprintf("cannot find MAINHEADKEY_CRYPTSALT in main-header\n");
+                return -1;
+            }
+            if (crypto_derive_key(g_options.encryptpass, passlen, salt, saltsize, kdfiter, key)!=0)
+            {   errprintf("cannot derive the encryption key from the password\n");
+                return -1;
+            }
+            crypto_ctx_init(&cryptctx);
+            if ((crypto_ctx_setkey(&cryptctx, key)==0) && 
+                (crypto_aes256gcm(cryptbufsize, &clearsize, bufcheckcrypt, bufcheckclear, 0, NULL, 0, false, &cryptctx)==0))
+                gcry_md_hash_buffer(GCRY_MD_MD5, md5sumnew, bufcheckclear, clearsize);
+            crypto_ctx_destroy(&cryptctx);
+            if ((memcmp(md5sumar, md5sumnew, 16)==0) && (crypto_set_key(key)!=0))
+                return -1;
+            memset(key, 0, sizeof(key));
+        }
+        else if (exar->ai.cryptalgo==ENCRYPT_BLOWFISH)
+        {
+            if (crypto_blowfish(cryptbufsize, &clearsize, bufcheckcrypt, bufcheckclear, g_options.encryptpass, passlen, false)==0)
+                gcry_md_hash_buffer(GCRY_MD_MD5, md5sumnew, bufcheckclear, clearsize);
+        }
+        else
+        {   errprintf("this archive has been encrypted with an unsupported algorithm: %ld\n", (long)exar->ai.cryptalgo);
+            return -1;
+        }
         
         if (memcmp(md5sumar, md5sumnew, 16)!=0)
         {   errprintf("you have to provide the password which was used to create archive, cannot decrypt the test buffer.\n");
@@ -1388,9 +1492,15 @@ int oper_restore(char *archive, int argc, char **argv, int oper)
     }
 
     // create decompression threads
+    blkpool_set_max_memory(options_get_max_memory());
+    if ((queue_set_max_memory(&g_queue, options_get_max_memory())!=FSAERR_SUCCESS)
+        || (queue_set_workers(&g_queue, min(g_options.compressjobs, FSA_MAX_COMPJOBS))!=FSAERR_SUCCESS))
+    {   errprintf("cannot configure the queue\n");
+        goto do_extract_error;
+    }
     for (i=0; (i<g_options.compressjobs) && (i<FSA_MAX_COMPJOBS); i++)
     {
-        if (pthread_create(&thread_decomp[i], NULL, thread_decomp_fct, NULL) != 0)
+        if (pthread_create(&thread_decomp[i], NULL, thread_decomp_fct, (void*)(long)i) != 0)
         {   errprintf("pthread_create(thread_decomp_fct) failed\n");
             goto do_extract_error;
         }
@@ -1505,7 +1615,7 @@ int oper_restore(char *archive, int argc, char **argv, int oper)
     
     if ((oper==OPER_RESTFS) || (oper==OPER_RESTDIR))
     {
-        if ((exar.ai.cryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo!=ENCRYPT_BLOWFISH))
+        if ((exar.ai.cryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo==ENCRYPT_NONE))
         {   errprintf("this archive has been encrypted, you have to provide a password on the command line using option '-c'\n");
             goto do_extract_error;
         }
@@ -56,10 +56,17 @@
 #include "crypto.h"
 #include "error.h"
 #include "queue.h"
+#include "blkpool.h"
+#include "comppolicy.h"
+#include "zeroblock.h"
+#include "compdict.h"
+#include "dirwalk.h"
+#include "readpool.h"
 
 typedef struct s_savear
 {   carchwriter ai;
     cregmulti   regmulti;
+    creadpool   readpool; // threads which read the blocks of the large files in advance
     cdichl      *dichardlinks;
     cstats      stats;
     int         fstype;
@@ -67,6 +74,11 @@ typedef struct s_savear
     u64         objectid;
     u64         cost_global;
     u64         cost_current;
+    u64         groupid; // solid group of the last block added to the queue or 0 (option -g)
+    u64         groupsource; // id of the file the blocks of this group come from or 0 for blocks of small files
+    u32         groupcount; // how many blocks have been added to this group
+    u32         zeromd5size; // size of the last block of zeros or 0
+    u8          zeromd5[16]; // md5 of the last block of zeros (they usually all have the same size)
 } csavear;
 
 typedef struct s_devinfo
@@ -74,33 +86,52 @@ typedef struct s_devinfo
     char        partmount[PATH_MAX];
     bool        mountedbyfsa;
     int         fstype;
+    u64         cost; // cost of the filesystem used for the progress bar (estimated from the statistics of the filesystem)
 } cdevinfo;
 
-int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, char *fullpath, u64 filesize)
+// blocks which follow each other in the queue are compressed as one stream when they come from the same
+// source (a large file or the small files) and when the group is not full (option -g)
+u64 createar_solid_group(csavear *save, u64 source)
+{
+    if (g_options.solidblocks<2)
+        return 0;
+    
+    if ((save->groupid==0) || (save->groupsource!=source) || (save->groupcount>=g_options.solidblocks))
+    {   save->groupid=solidgroup_new();
+        save->groupsource=source;
+        save->groupcount=0;
+    }
+    save->groupcount++;
+    return save->groupid;
+}
+
+// the file descriptor fd is opened and closed by createar_save_file(), or the file has already been read by
+// a reader thread when job is not NULL (see readpool.c)
+int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, int fd, u64 filesize, creadjob *job)
 {
     char databuf[FSA_MAX_SMALLFILESIZE];
-    u8 md5sum[16];
+    char *data=databuf;
     int ret=0;
     int res;
-    int fd;
-    
-    // The checksum will be in the obj-header not in a file footer
-    if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0)
-    {   sysprintf("Cannot open small file %s for reading\n", relpath);
-        return -1;
-    }
     
+    // the data are checked with the md5 of the shared block which is calculated by the compression threads
     msgprintf(MSG_DEBUG1, "backup_obj_regfile_multi(file=%s, size=%lld)\n", relpath, (long long)filesize);
     
-    res=read(fd, databuf, (long)filesize);
-    close(fd);
+    if (job!=NULL)
+    {   data=job->data;
+        res=job->res;
+        errno=job->err;
+    }
+    else
+    {   res=read(fd, databuf, (long)filesize);
+    }
     if (res!=filesize)
     {   
         if (res>=0 && res<filesize) // file has been truncated: pad with zeros
         {   ret=-1;
             errprintf("file [%s] has been truncated to %lld bytes (original size: %lld): padding with zeros\n", 
                 relpath, (long long)res, (long long)filesize);
-            memset(databuf+res, 0, filesize-res); // zero out remaining bytes
+            memset(data+res, 0, filesize-res); // zero out remaining bytes
         }
         else // read error
         {   sysprintf("Cannot read data block size=%ld from small file %s, res=%ld\n", (long)filesize, relpath, (long)res);
@@ -108,13 +139,10 @@ int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, char
         }
     }
     
-    gcry_md_hash_buffer(GCRY_MD_MD5, md5sum, databuf, filesize);
-    dico_add_data(header, 0, DISKITEMKEY_MD5SUM, md5sum, 16);
-    
     // if shared-block with many small files is full, push it to queue and make a new one
     if (regmulti_save_enough_space_for_new_file(&save->regmulti, filesize)==false)
     {
-        if (regmulti_save_enqueue(&save->regmulti, &g_queue, save->fsid)!=0)
+        if (regmulti_save_enqueue(&save->regmulti, &g_queue, save->fsid, createar_solid_group(save, 0))!=0)
         {   errprintf("Cannot queue last block of small-files\n");
             return -1;
         }
@@ -123,7 +151,7 @@ int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, char
     }
     
     // copy current small file to the shared-block
-    if (regmulti_save_addfile(&save->regmulti, header, databuf, filesize)!=0)
+    if (regmulti_save_addfile(&save->regmulti, header, data, filesize)!=0)
     {   errprintf("Cannot add small-file %s to regmulti structure\n", relpath);
         return -1;
     }
@@ -131,62 +159,215 @@ int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, char
     return ret;
 }
 
-int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, char *fullpath, u64 filesize) // large or empty files
+// the md5 of a block of zeros is only calculated when its size changes (zeros is a block of that size)
+void createar_zero_md5(csavear *save, char *zeros, u32 size, u8 *md5)
+{
+    if (save->zeromd5size!=size)
+    {   gcry_md_hash_buffer(GCRY_MD_MD5, save->zeromd5, zeros, size);
+        save->zeromd5size=size;
+    }
+    memcpy(md5, save->zeromd5, 16);
+}
+
+int createar_compare_gaps(const void *a, const void *b)
+{
+    u64 gapa=*(const u64 *)a;
+    u64 gapb=*(const u64 *)b;
+    
+    return (gapa < gapb)?-1:((gapa > gapb)?1:0);
+}
+
+// finds the data of a sparse file with SEEK_DATA/SEEK_HOLE: extents is an array of (offset, length) pairs
+// the extents separated by the smallest holes are merged when there are too many to fit in the header
+int createar_get_extents(int fd, u64 filesize, u64 **extents, u32 *count)
+{
+    u64 *newextents;
+    u32 maxcount=0;
+    u64 *gaps;
+    u64 mingap;
+    u32 merge;
+    s64 data;
+    s64 hole;
+    u64 gap;
+    u64 pos;
+    u32 i, j;
+    
+    *extents=NULL;
+    *count=0;
+    
+    for (pos=0; pos < filesize; pos=hole)
+    {
+        if ((data=lseek64(fd, pos, SEEK_DATA))<0)
+        {   if (errno==ENXIO) // no more data after pos: the end of the file is a hole
+                break;
+            free(*extents); // SEEK_DATA is not supported by the filesystem
+            *extents=NULL;
+            return -1;
+        }
+        if (data>=filesize)
+            break;
+        if ((hole=lseek64(fd, data, SEEK_HOLE))<0)
+        {   free(*extents);
+            *extents=NULL;
+            return -1;
+        }
+        hole=min(hole, filesize);
+        
+        if (*count>=maxcount)
+        {   maxcount=(maxcount>0)?(maxcount*2):64;
+            if ((newextents=realloc(*extents, 2*maxcount*sizeof(u64)))==NULL)
+            {   errprintf("realloc(%ld) failed: out of memory\n", (long)(2*maxcount*sizeof(u64)));
+                free(*extents);
+                *extents=NULL;
+                return -1;
+            }
+            *extents=newextents;
+        }
+        (*extents)[2*(*count)+0]=data;
+        (*extents)[2*(*count)+1]=hole-data;
+        (*count)++;
+    }
+    
+    // the smallest holes are merged with the data around them (they are read as zeros) when there are too many
+    if (*count > FSA_MAX_EXTENTS)
+    {
+        if ((gaps=malloc((*count-1)*sizeof(u64)))==NULL)
+        {   errprintf("malloc(%ld) failed: out of memory\n", (long)((*count-1)*sizeof(u64)));
+            free(*extents);
+            *extents=NULL;
+            return -1;
+        }
+        for (i=1; i < *count; i++)
+            gaps[i-1]=(*extents)[2*i]-((*extents)[2*(i-1)]+(*extents)[2*(i-1)+1]);
+        qsort(gaps, *count-1, sizeof(u64), createar_compare_gaps);
+        mingap=gaps[*count-FSA_MAX_EXTENTS-1]; // the holes which are smaller are merged
+        free(gaps);
+        
+        for (i=1, j=0, merge=*count-FSA_MAX_EXTENTS; i < *count; i++)
+        {   gap=(*extents)[2*i]-((*extents)[2*j]+(*extents)[2*j+1]);
+            if ((merge>0) && (gap<=mingap))
+            {   (*extents)[2*j+1]=(*extents)[2*i]+(*extents)[2*i+1]-(*extents)[2*j];
+                merge--;
+            }
+            else
+            {   j++;
+                (*extents)[2*j+0]=(*extents)[2*i+0];
+                (*extents)[2*j+1]=(*extents)[2*i+1];
+            }
+        }
+        *count=j+1;
+    }
+    
+    return 0;
+}
+
+int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, int fd, u64 filesize) // large or empty files
 {
     cdico *footerdico=NULL;
     struct s_blockinfo blkinfo;
-    gcry_md_hd_t md5ctx;
+    u64 wholefile[2]={0, filesize};
+    u64 *extents=wholefile;
+    u64 *extentsle;
     u32 curblocksize;
+    u32 extcount=1;
+    u64 blockcount;
+    u64 blocknum;
     bool eof=false;
-    u64 remaining;
-    char text[256];
+    int comppolicy;
+    creadjob job;
+    u64 extend;
+    u64 fileid;
     u8 *origblock;
-    u8 *md5tmp;
-    u8 md5sum[16];
     u64 filepos;
+    u64 nextpos;
+    u32 nextext;
+    u64 flags=0;
     int ret=0;
     int res;
-    int fd;
+    u32 i;
     
-    if (gcry_md_open(&md5ctx, GCRY_MD_MD5, 0) != GPG_ERR_NO_ERROR)
-    {   errprintf("gcry_md_open() failed\n");
-        return -1;
+    // only the data of sparse files are read: the restoration recreates the holes between the extents
+    if ((dico_get_u64(header, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_FLAGS, &flags)==0) && (flags&FSA_FILEFLAGS_SPARSE)
+        && (createar_get_extents(fd, filesize, &extents, &extcount)==0))
+    {
+        if ((extentsle=malloc(2*max(extcount,1)*sizeof(u64)))==NULL)
+        {   errprintf("malloc(%ld) failed: out of memory\n", (long)(2*max(extcount,1)*sizeof(u64)));
+            ret=-1;
+            goto backup_obj_regfile_unique_error;
+        }
+        for (i=0; i < 2*extcount; i++)
+            extentsle[i]=cpu_to_le64(extents[i]);
+        res=dico_add_data(header, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_EXTENTS, extentsle, 2*extcount*sizeof(u64));
+        free(extentsle);
+        if (res!=0)
+        {   errprintf("dico_add_data(DISKITEMKEY_EXTENTS) failed\n");
+            ret=-1;
+            goto backup_obj_regfile_unique_error;
+        }
+        msgprintf(MSG_DEBUG1, "sparse file %s has %ld extents of data\n", relpath, (long)extcount);
     }
-    
-    if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0)
-    {   sysprintf("Cannot open %s for reading\n", relpath);
-        return -1;
+    else
+    {   extents=wholefile; // the file is not sparse or SEEK_DATA is not supported
+        extcount=(filesize>0)?1:0;
     }
     
-    // write header with file attributes (only if open64() works)
+    // write header with file attributes (the file has been opened by createar_save_file())
     queue_add_header(&g_queue, header, FSA_MAGIC_OBJT, save->fsid);
     
+    fileid=comphint_new_file(); // the compression threads remember if the blocks of this file are compressible
+    comppolicy=(g_options.comppolicy==true)?comppolicy_from_name(relpath):COMPPOLICY_DEFAULT;
     msgprintf(MSG_DEBUG1, "backup_obj_regfile_unique(file=%s, size=%lld)\n", relpath, (long long)filesize);
-    for (filepos=0; (filesize>0) && (filepos < filesize) && (get_interrupted()==false); filepos+=curblocksize)
+    
+    // the blocks are read by the reader threads up to FSA_READER_DEPTH blocks in advance (see readpool.c)
+    for (i=0, blockcount=0; i < extcount; i++)
+        blockcount+=(extents[2*i+1]+g_options.datablocksize-1)/g_options.datablocksize;
+    readpool_start_file(&save->readpool, fd, (blockcount>1));
+    nextext=0;
+    nextpos=(extcount>0)?extents[0]:0;
+    
+    for (blocknum=0; (blocknum < blockcount) && (get_interrupted()==false); blocknum++)
     {
-        remaining=filesize-filepos;
-        curblocksize=min(remaining, g_options.datablocksize);
-        msgprintf(MSG_DEBUG2, "----> filepos=%lld, remaining=%lld, curblocksize=%lld\n", (long long)filepos, (long long)remaining, (long long)curblocksize);
+        // submit the next blocks of the file to the reader threads
+        while ((nextext < extcount) && (readpool_is_full(&save->readpool)==false))
+        {
+            extend=extents[2*nextext]+extents[2*nextext+1];
+            curblocksize=min(extend-nextpos, g_options.datablocksize);
+            origblock=blkpool_alloc(curblocksize);
+            if (!origblock)
+            {   errprintf("blkpool_alloc(%ld) failed: cannot allocate data block\n", (long)curblocksize);
+                ret=-1;
+                goto backup_obj_regfile_unique_error;
+            }
+            readpool_submit(&save->readpool, (char*)origblock, nextpos, curblocksize);
+            nextpos+=curblocksize;
+            if ((nextpos>=extend) && (++nextext < extcount))
+                nextpos=extents[2*nextext];
+        }
         
-        origblock=malloc(curblocksize);
-        if (!origblock)
-        {   errprintf("malloc(%ld) failed: cannot allocate data block\n", (long)origblock);
-            ret=-1;
+        // get the oldest block which has been submitted
+        if (readpool_wait(&save->readpool, &job)!=0)
+        {   ret=-1;
             goto backup_obj_regfile_unique_error;
         }
+        origblock=(u8*)job.data;
+        filepos=job.offset;
+        curblocksize=job.size;
+        msgprintf(MSG_DEBUG2, "----> filepos=%lld, curblocksize=%lld\n", (long long)filepos, (long long)curblocksize);
         
-        if (eof==false) // file has not been truncated: read the next block
+        if (eof==false) // file has not been truncated: check the block which has been read
         {
-            if ((res=read(fd, origblock, (long)curblocksize))!=curblocksize)
+            if (job.res!=curblocksize)
             {   ret=-1;
-                if (res>=0 && res<curblocksize) // file has been truncated: pad with zeros
+                if (job.res>=0 && job.res<curblocksize) // file has been truncated: pad with zeros
                 {   errprintf("file [%s] has been truncated to %lld bytes (original size: %lld): padding with zeros\n", 
-                        relpath, (long long)(filepos+res), (long long)filesize);
-                    eof=true; // set oef to true so that we don't try to read the next blocks
-                    memset(origblock+res, 0, curblocksize-res); // zero out remaining bytes
+                        relpath, (long long)(filepos+job.res), (long long)filesize);
+                    eof=true; // set oef to true so that the next blocks are ignored
+                    memset(origblock+job.res, 0, curblocksize-job.res); // zero out remaining bytes
                 }
-                else if (res<0) // read error
-                {   sysprintf("Cannot read data block from %s, block=%ld and res=%ld\n", relpath, (long)curblocksize, (long)res);
+                else if (job.res<0) // read error
+                {   errno=job.err;
+                    sysprintf("Cannot read data block from %s, block=%ld and res=%ld\n", relpath, (long)curblocksize, (long)job.res);
+                    blkpool_free(origblock);
                     ret=-1;
                     goto backup_obj_regfile_unique_error;
                 }
@@ -197,7 +378,9 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
             memset(origblock, 0, curblocksize);
         }
         
-        gcry_md_write(md5ctx, origblock, curblocksize);
+        // the magic at the beginning of the file tells its type when the name does not
+        if ((filepos==extents[0]) && (g_options.comppolicy==true) && (comppolicy==COMPPOLICY_DEFAULT))
+            comppolicy=comppolicy_from_data(origblock, curblocksize);
         
         // add block to the queue
         memset(&blkinfo, 0, sizeof(blkinfo));
@@ -205,7 +388,25 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
         blkinfo.blkdata=(char*)origblock;
         blkinfo.blkoffset=filepos;
         blkinfo.blkfsid=save->fsid;
-        if (queue_add_block(&g_queue, &blkinfo, QITEM_STATUS_TODO)!=0)
+        blkinfo.blkfileid=fileid;
+        blkinfo.blkcomppolicy=comppolicy;
+        
+        // blocks of zeros are written without data and they do not go through the compression threads
+        // (not in encrypted archives where the data of all the blocks are authenticated)
+        if ((g_options.encryptalgo==ENCRYPT_NONE) && (is_block_zero((char*)origblock, curblocksize)==true))
+        {   createar_zero_md5(save, (char*)origblock, curblocksize, blkinfo.blkdatamd5);
+            blkpool_free(origblock);
+            blkinfo.blkdata=NULL;
+            blkinfo.blkzero=true;
+            blkinfo.blkarcsumalgo=g_options.csumalgo;
+            blkinfo.blkhasdatamd5=true;
+            res=queue_add_block(&g_queue, &blkinfo, QITEM_STATUS_DONE);
+        }
+        else // only the blocks which are compressed take a place in the solid group (no group for one block)
+        {   blkinfo.blkgroupid=(filesize>g_options.datablocksize)?createar_solid_group(save, fileid):0;
+            res=queue_add_block(&g_queue, &blkinfo, QITEM_STATUS_TODO);
+        }
+        if (res!=0)
         {   sysprintf("queue_add_block(%s) failed\n", relpath);
             ret=-1;
             goto backup_obj_regfile_unique_error;
@@ -218,18 +419,10 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
         goto backup_obj_regfile_unique_error;
     }
     
-    // write the footer with the global md5sum
-    if ((md5tmp=gcry_md_read(md5ctx, GCRY_MD_MD5))==NULL)
-    {   errprintf("gcry_md_read() failed\n");
-        ret=-1;
-        goto backup_obj_regfile_unique_error;
-    }
-    memcpy(md5sum, md5tmp, 16);
-    gcry_md_close(md5ctx);
+    msgprintf(MSG_DEBUG1, "--> finished loop for file=%s, size=%lld\n", relpath, (long long)filesize);
     
-    msgprintf(MSG_DEBUG1, "--> finished loop for file=%s, size=%lld, md5=[%s]\n", relpath, (long long)filesize, format_md5(text, sizeof(text), md5sum));
-    
-    // don't write the footer for empty files (checksum does not make sense --> don't waste space in the archive)
+    // the writer thread adds the md5 of the md5 of the blocks to the footer when it writes it (the blocks are
+    // hashed by the compression threads) and the footer is not written for empty files (no data to check)
     if (filesize>0)
     {
         if ((footerdico=dico_alloc())==NULL)
@@ -237,7 +430,6 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
             ret=-1;
             goto backup_obj_regfile_unique_error;
         }
-        dico_add_data(footerdico, 0, BLOCKFOOTITEMKEY_MD5SUM, md5sum, 16);
         
         if (queue_add_header(&g_queue, footerdico, FSA_MAGIC_FILF, save->fsid)!=0)
         {   msgprintf(MSG_VERB2, "Cannot write footer for file %s\n", relpath);
@@ -247,11 +439,24 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
     }
     
 backup_obj_regfile_unique_error:
-    close(fd);
+    readpool_cancel(&save->readpool); // blocks read in advance when the file has not been saved until the end
+    if (extents!=wholefile)
+        free(extents);
     return ret;
 }
 
-int createar_item_xattr(csavear *save, char *root, char *relpath, struct stat64 *statbuf, cdico *d)
+// the extended attributes are read from the file descriptor of the object when it is open (no path lookup)
+int createar_listxattr(int fd, char *fullpath, char *list, size_t size)
+{
+    return (fd>=0)?flistxattr(fd, list, size):llistxattr(fullpath, list, size);
+}
+
+int createar_getxattr(int fd, char *fullpath, char *name, void *value, size_t size)
+{
+    return (fd>=0)?fgetxattr(fd, name, value, size):lgetxattr(fullpath, name, value, size);
+}
+
+int createar_item_xattr(csavear *save, char *root, char *relpath, int fd, struct stat64 *statbuf, cdico *d)
 {
     char fullpath[PATH_MAX];
     char *valbuf=NULL;
@@ -269,13 +474,13 @@ int createar_item_xattr(csavear *save, char *root, char *relpath, struct stat64
     attrcnt=0;
     
     memset(buffer, 0, sizeof(buffer));
-    listlen=llistxattr(fullpath, buffer, sizeof(buffer)-1);
+    listlen=createar_listxattr(fd, fullpath, buffer, sizeof(buffer)-1);
     msgprintf(MSG_DEBUG2, "xattr:llistxattr(%s)=%d\n", relpath, listlen);
     
     for (pos=0; (pos<listlen) && (pos<sizeof(buffer)); pos+=len)
     {
         len=strlen(buffer+pos)+1;
-        attrsize=lgetxattr(fullpath, buffer+pos, NULL, 0);
+        attrsize=createar_getxattr(fd, fullpath, buffer+pos, NULL, 0);
         msgprintf(MSG_VERB2, "            xattr:file=[%s], attrid=%d, name=[%s], size=%ld\n", relpath, (int)attrcnt, buffer+pos, (long)attrsize);
         if ((attrsize>0) && (attrsize>65535LL))
         {   errprintf("file [%s] has an xattr [%s] with data too big (size=%ld, maxsize=64k)\n", relpath, buffer+pos, (long)attrsize);
@@ -289,7 +494,7 @@ int createar_item_xattr(csavear *save, char *root, char *relpath, struct stat64
             continue; // ignore the current xattr
         }
         errno=0;
-        valsize=lgetxattr(fullpath, buffer+pos, valbuf, attrsize);
+        valsize=createar_getxattr(fd, fullpath, buffer+pos, valbuf, attrsize);
         msgprintf(MSG_VERB2, "            xattr:lgetxattr(%s,%s)=%d\n", relpath, buffer+pos, valsize);
         if (valsize>=0)
         {
@@ -319,7 +524,7 @@ int createar_item_xattr(csavear *save, char *root, char *relpath, struct stat64
     return ret;
 }
 
-int createar_item_winattr(csavear *save, char *root, char *relpath, struct stat64 *statbuf, cdico *d)
+int createar_item_winattr(csavear *save, char *root, char *relpath, int fd, struct stat64 *statbuf, cdico *d)
 {
     char fullpath[PATH_MAX];
     char *valbuf=NULL;
@@ -341,7 +546,7 @@ int createar_item_winattr(csavear *save, char *root, char *relpath, struct stat6
             continue;
         
         errno=0;
-        if ((attrsize=lgetxattr(fullpath, winattr[i], NULL, 0)) < 0) // get the size of the attribute
+        if ((attrsize=createar_getxattr(fd, fullpath, winattr[i], NULL, 0)) < 0) // get the size of the attribute
         {
             if (errno!=ENOATTR)
             {
@@ -364,7 +569,7 @@ int createar_item_winattr(csavear *save, char *root, char *relpath, struct stat6
             ret=-1;
             continue; // ignore the current xattr
         }
-        valsize=lgetxattr(fullpath, winattr[i], valbuf, attrsize);
+        valsize=createar_getxattr(fd, fullpath, winattr[i], valbuf, attrsize);
         msgprintf(MSG_VERB2, "            winattr:lgetxattr-win(%s,%s)=%d\n", relpath, winattr[i], valsize);
         if (valsize>=0)
         {
@@ -396,7 +601,7 @@ int createar_item_winattr(csavear *save, char *root, char *relpath, struct stat6
     return ret;
 }
 
-int createar_item_stdattr(csavear *save, char *root, char *relpath, struct stat64 *statbuf, cdico *d, int *objtype, u64 *filecost)
+int createar_item_stdattr(csavear *save, char *root, char *relpath, int dirfd, char *name, struct stat64 *statbuf, cdico *d, int *objtype, u64 *filecost)
 {
     struct stat64 stattarget;
     char fullpath[PATH_MAX];
@@ -459,7 +664,8 @@ int createar_item_stdattr(csavear *save, char *root, char *relpath, struct stat6
             *objtype=OBJTYPE_SYMLINK;
             memset(buffer, 0, sizeof(buffer));
             memset(buffer2, 0, sizeof(buffer2));
-            if ((readlink(fullpath, buffer, sizeof(buffer)))<0)
+            res=((dirfd>=0) && (name!=NULL))?readlinkat(dirfd, name, buffer, sizeof(buffer)):readlink(fullpath, buffer, sizeof(buffer));
+            if (res<0)
             {   sysprintf("readlink(%s) failed\n", fullpath);
                 return -1;
             }
@@ -572,15 +778,19 @@ int createar_item_stdattr(csavear *save, char *root, char *relpath, struct stat6
     return 0;
 }
 
-int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *statbuf, u64 *costeval)
+// name is the name of the object in the directory dirfd, or NULL when dirfd is the directory to save itself
+int createar_save_file(csavear *save, char *root, char *relpath, int dirfd, char *name, struct stat64 *statbuf, u64 *costeval, creadjob *job)
 {
     char fullpath[PATH_MAX];
     char strprogress[256];
     cdico *dicoattr;
     int attrerrors=0;
+    int openerr=0;
+    int objfd=-1;
     u64 filecost;
     u64 progress;
     int objtype;
+    int ret=0;
     int res;
     
     // init    
@@ -599,27 +809,46 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
         return -1; // fatal error
     }
     
-    if (createar_item_stdattr(save, root, relpath, statbuf, dicoattr, &objtype, &filecost)!=0)
+    if (createar_item_stdattr(save, root, relpath, dirfd, name, statbuf, dicoattr, &objtype, &filecost)!=0)
     {   msgprintf(MSG_STACK, "backup_item_stdattr() failed: cannot read standard attributes on [%s]\n", relpath);
         attrerrors++;
     }
     
     // --- cost required for the progression info
     if (costeval!=NULL) 
-    {   *costeval+=filecost;
+    {   if ((g_options.compressdict==true) && (objtype==OBJTYPE_REGFILEMULTI))
+            compdict_add_sample(fullpath, statbuf->st_size);
+        *costeval+=filecost;
         dico_destroy(dicoattr);
         return 0;
     }
     
+    // ---- open regular files once: their attributes and their contents are read from the same descriptor
+    if (name==NULL) // the object is the directory itself
+    {   objfd=dirfd;
+    }
+    else if ((job!=NULL) && (attrerrors==0) && (objtype==OBJTYPE_REGFILEMULTI)) // opened by a reader thread
+    {   objfd=job->fd;
+    }
+    else if ((attrerrors==0) && ((objtype==OBJTYPE_REGFILEUNIQUE) || (objtype==OBJTYPE_REGFILEMULTI)))
+    {   errno=0;
+        if (dirfd>=0)
+            objfd=openat(dirfd, name, O_RDONLY|O_LARGEFILE|O_NOFOLLOW);
+        else
+            objfd=open64(fullpath, O_RDONLY|O_LARGEFILE);
+        if (objfd<0)
+            openerr=(errno!=0)?errno:EIO;
+    }
+    
     // ---- backup other file attributes (xattr + winattr)
-    if (createar_item_xattr(save, root, relpath, statbuf, dicoattr)!=0)
+    if (createar_item_xattr(save, root, relpath, objfd, statbuf, dicoattr)!=0)
     {   msgprintf(MSG_STACK, "backup_item_xattr() failed: cannot prepare xattr-dico for item %s\n", relpath);
         attrerrors++;
     }
     
     if (filesys[save->fstype].winattr==true)
     {
-        if (createar_item_winattr(save, root, relpath, statbuf, dicoattr)!=0)
+        if (createar_item_winattr(save, root, relpath, objfd, statbuf, dicoattr)!=0)
         {   msgprintf(MSG_STACK, "backup_item_winattr() failed: cannot prepare winattr-dico for item %s\n", relpath);
             attrerrors++;
         }
@@ -629,9 +858,9 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
     if (get_interrupted()==false) 
     {
         memset(strprogress, 0, sizeof(strprogress));
+        save->cost_current+=filecost;
         if (save->cost_global>0)
-        {   save->cost_current+=filecost;
-            progress=((save->cost_current)*100)/(save->cost_global);
+        {   progress=((save->cost_current)*100)/(save->cost_global);
             if (progress>=0 && progress<=100)
                 snprintf(strprogress, sizeof(strprogress), "[%3d%%]", (int)progress);
         }
@@ -645,11 +874,12 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
             if (attrerrors>0)
             {   save->stats.err_dir++;
                 dico_destroy(dicoattr);
-                return 0; // error is not fatal, operation must continue
+                goto createar_save_file_end; // error is not fatal, operation must continue
             }
             if (queue_add_header(&g_queue, dicoattr, FSA_MAGIC_OBJT, save->fsid)!=0)
             {   errprintf("queue_add_header(%s) failed\n", relpath);
-                return -1; // fatal error
+                ret=-1; // fatal error
+                goto createar_save_file_end;
             }
             save->stats.cnt_dir++;
             break;
@@ -657,11 +887,12 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
             if (attrerrors>0)
             {   save->stats.err_symlink++;
                 dico_destroy(dicoattr);
-                return 0; // error is not fatal, operation must continue
+                goto createar_save_file_end; // error is not fatal, operation must continue
             }
             if (queue_add_header(&g_queue, dicoattr, FSA_MAGIC_OBJT, save->fsid)!=0)
             {   errprintf("queue_add_header(%s) failed\n", relpath);
-                return -1; // fatal error
+                ret=-1; // fatal error
+                goto createar_save_file_end;
             }
             save->stats.cnt_symlink++;
             break;
@@ -669,11 +900,12 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
             if (attrerrors>0)
             {   save->stats.err_hardlink++;
                 dico_destroy(dicoattr);
-                return 0; // error is not fatal, operation must continue
+                goto createar_save_file_end; // error is not fatal, operation must continue
             }
             if (queue_add_header(&g_queue, dicoattr, FSA_MAGIC_OBJT, save->fsid)!=0)
             {   errprintf("queue_add_header(%s) failed\n", relpath);
-                return -1; // fatal error
+                ret=-1; // fatal error
+                goto createar_save_file_end;
             }
             save->stats.cnt_hardlink++;
             break;
@@ -684,11 +916,12 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
             if (attrerrors>0)
             {   save->stats.err_special++;
                 dico_destroy(dicoattr);
-                return 0; // error is not fatal, operation must continue
+                goto createar_save_file_end; // error is not fatal, operation must continue
             }
             if (queue_add_header(&g_queue, dicoattr, FSA_MAGIC_OBJT, save->fsid)!=0)
             {   errprintf("queue_add_header(%s) failed\n", relpath);
-                return -1; // fatal error
+                ret=-1; // fatal error
+                goto createar_save_file_end;
             }
             save->stats.cnt_special++;
             break;
@@ -696,12 +929,19 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
             if (attrerrors>0)
             {   save->stats.err_regfile++;
                 dico_destroy(dicoattr);
-                return 0; // error is not fatal, operation must continue
+                goto createar_save_file_end; // error is not fatal, operation must continue
+            }
+            if (objfd<0)
+            {   errno=openerr;
+                sysprintf("Cannot open %s for reading\n", relpath);
+                save->stats.err_regfile++;
+                dico_destroy(dicoattr);
+                goto createar_save_file_end; // not a fatal error, oper must continue
             }
-            if ((res=createar_obj_regfile_unique(save, dicoattr, relpath, fullpath, statbuf->st_size))!=0)
+            if ((res=createar_obj_regfile_unique(save, dicoattr, relpath, objfd, statbuf->st_size))!=0)
             {   msgprintf(MSG_STACK, "backup_obj_regfile_unique(%s)=%d failed\n", relpath, res);
                 save->stats.err_regfile++;
-                return 0; // not a fatal error, oper must continue
+                goto createar_save_file_end; // not a fatal error, oper must continue
             }
             else
             {   save->stats.cnt_regfile++;
@@ -711,12 +951,19 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
             if (attrerrors>0)
             {   save->stats.err_regfile++;
                 dico_destroy(dicoattr);
-                return 0; // error is not fatal, operation must continue
+                goto createar_save_file_end; // error is not fatal, operation must continue
+            }
+            if (objfd<0)
+            {   errno=openerr;
+                sysprintf("Cannot open %s for reading\n", relpath);
+                save->stats.err_regfile++;
+                dico_destroy(dicoattr);
+                goto createar_save_file_end; // not a fatal error, oper must continue
             }
-            if ((res=createar_obj_regfile_multi(save, dicoattr, relpath, fullpath, statbuf->st_size))!=0)
+            if ((res=createar_obj_regfile_multi(save, dicoattr, relpath, objfd, statbuf->st_size, job))!=0)
             {   msgprintf(MSG_STACK, "backup_obj_regfile_multi(%s)=%d failed\n", relpath, res);
                 save->stats.err_regfile++;
-                return 0; // not a fatal error, oper must continue
+                goto createar_save_file_end; // not a fatal error, oper must continue
             }
             else
             {   save->stats.cnt_regfile++;
@@ -724,83 +971,162 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
             break;
         default: // unknown type
             errprintf("invalid object type: %ld for file %s\n", (long)objtype, relpath);
-            return -1; // fatal error
+            ret=-1; // fatal error
             break;
     }
     
-    return 0;
+createar_save_file_end:
+    if ((name!=NULL) && (objfd>=0) && ((job==NULL) || (objfd!=job->fd))) // readpool_release_file() closes job->fd
+        close(objfd);
+    return ret;
 }
 
-int createar_save_directory(csavear *save, char *root, char *path, u64 *costeval)
+// the reader threads ask the kernel to read the beginning of the next large file of the directory while
+// the main thread saves the current one (entries before first have already been saved or hinted)
+void createar_prefetch_next(csavear *save, cwalkdir *wdir, int dirfd, u32 first)
+{
+    cwalkent *ent;
+    int fd;
+    u32 i;
+    
+    for (i=first; i < wdir->count; i++)
+    {
+        ent=&wdir->entries[i];
+        if ((ent->staterr==0) && (ent->excluded==false) && S_ISREG(ent->statbuf.st_mode) && (ent->statbuf.st_size>=g_options.smallfilethresh))
+        {   if ((fd=openat(dirfd, ent->name, O_RDONLY|O_LARGEFILE|O_NOFOLLOW))>=0)
+                readpool_prefetch(&save->readpool, fd, min((u64)ent->statbuf.st_size, (u64)FSA_READER_DEPTH*g_options.datablocksize));
+            return;
+        }
+    }
+}
+
+// the reader threads open and read the next small files of the directory, but not after the next subdirectory
+// since its contents are saved before the entries which follow it (next is the first entry not yet submitted)
+void createar_prefetch_files(csavear *save, cwalkdir *wdir, int dirfd, u32 first, u32 *next)
+{
+    cwalkent *ent;
+    char *data;
+    
+    // the files are submitted in batches so that the threads are not woken for each file
+    if (readpool_count_files(&save->readpool) > FSA_READER_FILES/2)
+        return;
+    
+    for (*next=max(*next, first); (*next < wdir->count) && (readpool_can_submit_file(&save->readpool)==true); (*next)++)
+    {
+        ent=&wdir->entries[*next];
+        if ((ent->staterr!=0) || ((ent->excluded==false) && S_ISDIR(ent->statbuf.st_mode)))
+            break;
+        if ((ent->excluded==false) && S_ISREG(ent->statbuf.st_mode) && (ent->statbuf.st_size > 0)
+            && (ent->statbuf.st_size < g_options.smallfilethresh) && (ent->statbuf.st_nlink==1))
+        {   if ((data=blkpool_alloc(ent->statbuf.st_size))==NULL)
+                break; // the main thread will read the file itself
+            readpool_submit_file(&save->readpool, dirfd, ent->name, data, ent->statbuf.st_size);
+        }
+    }
+    readpool_wake(&save->readpool);
+}
+
+// name is the name of the directory in parentfd, or NULL when the directory is the root of the walk
+int createar_save_directory(csavear *save, cdirwalk *walk, cwalkdir *wdir, char *root, int parentfd, char *name, u64 *costeval)
 {
     char fulldirpath[PATH_MAX];
     char fullpath[PATH_MAX];
     char relpath[PATH_MAX];
-    struct stat64 statbuf;
-    struct dirent *dir;
-    DIR *dirdesc;
+    creadjob *prefetched;
+    u32 prefetch=0;
+    cwalkent *ent;
+    creadjob job;
+    int dirfd=-1;
     int ret=0;
+    int res;
+    u32 i;
     
-    // init
-    concatenate_paths(fulldirpath, sizeof(fulldirpath), root, path);
+    // init: the entries of the directory are read by the walker threads (see dirwalk.c)
+    concatenate_paths(fulldirpath, sizeof(fulldirpath), root, wdir->relpath);
+    dirwalk_wait_dir(walk, wdir);
     
-    if (!(dirdesc=opendir(fulldirpath)))
-    {   sysprintf("cannot open directory %s\n", fulldirpath);
-        return 0; // not a fatal error, oper must continue
+    if (wdir->opendirerr!=0)
+    {   errno=wdir->opendirerr;
+        sysprintf("cannot open directory %s\n", fulldirpath);
+        goto backup_dir_err; // not a fatal error, oper must continue
     }
     
     // backup the directory itself (important for the root of the filesystem)
-    if (lstat64(fulldirpath, &statbuf)!=0)
-    {   sysprintf("cannot lstat64(%s)\n", fulldirpath);
+    if (wdir->staterr!=0)
+    {   errno=wdir->staterr;
+        sysprintf("cannot lstat64(%s)\n", fulldirpath);
         ret=-1;
         goto backup_dir_err;
     }
     
+    // the entries are opened relative to the directory: the paths are only used when it cannot be opened
+    if (costeval==NULL)
+    {
+        if ((parentfd>=0) && (name!=NULL))
+            dirfd=openat(parentfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+        else
+            dirfd=open64(fulldirpath, O_RDONLY|O_DIRECTORY|O_LARGEFILE);
+        if (dirfd<0)
+            msgprintf(MSG_DEBUG1, "cannot open directory %s: using paths to read its entries\n", fulldirpath);
+    }
+    
     // save info about the directory itself
-    if (createar_save_file(save, root, path, &statbuf, costeval)!=0)
-    {   errprintf("createar_save_file(%s,%s) failed\n", root, path);
+    if (createar_save_file(save, root, wdir->relpath, dirfd, NULL, &wdir->statbuf, costeval, NULL)!=0)
+    {   errprintf("createar_save_file(%s,%s) failed\n", root, wdir->relpath);
         ret=-1;
         goto backup_dir_err;
     }
     
-    while (((dir = readdir(dirdesc)) != NULL) && (get_interrupted()==false))
+    for (i=0; (i < wdir->count) && (get_interrupted()==false); i++)
     {
-        // ---- ignore "." and ".." and ignore mount-points
-        if (strcmp(dir->d_name,".")==0 || strcmp(dir->d_name,"..")==0)
-            continue; // ignore "." and ".."
+        ent=&wdir->entries[i];
         
         // ---- calculate paths
-        concatenate_paths(relpath, sizeof(relpath), path, dir->d_name);
-        concatenate_paths(fullpath, sizeof(fullpath), fulldirpath, dir->d_name);
+        concatenate_paths(relpath, sizeof(relpath), wdir->relpath, ent->name);
+        concatenate_paths(fullpath, sizeof(fullpath), fulldirpath, ent->name);
         
         // ---- get details about current file
-        if (lstat64(fullpath, &statbuf)!=0)
-        {   sysprintf("cannot lstat64(%s)\n", fullpath);
+        if (ent->staterr!=0)
+        {   errno=ent->staterr;
+            sysprintf("cannot lstat64(%s)\n", fullpath);
             ret=-1;
             goto backup_dir_err;
         }
         
         // check the list of excluded files/dirs
-        if ((exclude_check(&g_options.exclude, dir->d_name)==true) // is filename excluded ?
-            || (exclude_check(&g_options.exclude, relpath)==true)) // is filepath excluded ?
+        if (ent->excluded==true)
         {
             if (costeval==NULL) // dont log twice (eval + real)
                 msgprintf(MSG_VERB2, "file/dir=[%s] excluded\n", relpath);
             continue;
         }
         
+        if ((costeval==NULL) && (dirfd>=0))
+            createar_prefetch_files(save, wdir, dirfd, i, &prefetch);
+        
         // backup contents before the directory itself so that the dir-attributes are written after the dir contents
-        if (S_ISDIR(statbuf.st_mode))
+        if (S_ISDIR(ent->statbuf.st_mode))
         { 
-            if (createar_save_directory(save, root, relpath, costeval)!=0)
+            if ((ent->subdir==NULL) || (createar_save_directory(save, walk, ent->subdir, root, dirfd, ent->name, costeval)!=0))
             {   msgprintf(MSG_STACK, "createar_save_directory(%s) failed\n", relpath);
                 ret=-1;
                 goto backup_dir_err;
             }
+            ent->subdir=NULL; // the subdirectory has been released
         }
         else // not a directory
         {
-            if (createar_save_file(save, root, relpath, &statbuf, costeval)!=0)
+            if ((costeval==NULL) && (dirfd>=0) && S_ISREG(ent->statbuf.st_mode) && (ent->statbuf.st_size>=g_options.smallfilethresh))
+                createar_prefetch_next(save, wdir, dirfd, i+1);
+            prefetched=(readpool_get_file(&save->readpool, ent->name, &job)==0)?&job:NULL;
+            if ((prefetched!=NULL) && (prefetched->fd<0)) // the thread could not open it (too many open files?)
+            {   readpool_release_file(prefetched);
+                prefetched=NULL; // the file is opened by the main thread which reports the error
+            }
+            res=createar_save_file(save, root, relpath, dirfd, ent->name, &ent->statbuf, costeval, prefetched);
+            if (prefetched!=NULL)
+                readpool_release_file(prefetched);
+            if (res!=0)
             {   msgprintf(MSG_STACK, "createar_save_directory(%s) failed\n", relpath);
                 ret=-1;
                 goto backup_dir_err;
@@ -809,12 +1135,18 @@ int createar_save_directory(csavear *save, char *root, char *path, u64 *costeval
     }
     
 backup_dir_err:
-    closedir(dirdesc);
+    readpool_cancel_files(&save->readpool); // the small files read in advance use dirfd
+    if (dirfd>=0)
+        close(dirfd);
+    if (ret==0)
+        dirwalk_release_dir(walk, wdir);
     return ret;
 }
 
 int createar_save_directory_wrapper(csavear *save, char *root, char *path, u64 *costeval)
 {
+    cdirwalk walk;
+    cwalkdir *wdir;
     int ret;
     
     if ((save->dichardlinks=dichl_alloc())==NULL)
@@ -827,10 +1159,28 @@ int createar_save_directory_wrapper(csavear *save, char *root, char *path, u64 *
         return -1;
     }
     
-    ret=createar_save_directory(save, root, path, costeval);
+    if (dirwalk_init(&walk, root, FSA_WALKER_THREADS, FSA_WALKER_MAXENTRIES)!=0)
+    {   errprintf("dirwalk_init failed\n");
+        return -1;
+    }
+    
+    if (readpool_init(&save->readpool, FSA_READER_THREADS, FSA_READER_DEPTH, FSA_READER_FILES)!=0)
+    {   errprintf("readpool_init failed\n");
+        dirwalk_destroy(&walk);
+        return -1;
+    }
+    
+    if ((wdir=dirwalk_add_root(&walk, path))!=NULL)
+        ret=createar_save_directory(save, &walk, wdir, root, -1, NULL, costeval);
+    else
+        ret=-1;
+    
+    // the directories which have not been saved are released here when the walk has failed
+    dirwalk_destroy(&walk);
+    readpool_destroy(&save->readpool);
     
     // put all small files that are in the last block to the queue
-    if (regmulti_save_enqueue(&save->regmulti, &g_queue, save->fsid)!=0)
+    if (regmulti_save_enqueue(&save->regmulti, &g_queue, save->fsid, createar_solid_group(save, 0))!=0)
     {   errprintf("Cannot queue last block of small-files\n");
         return -1;
     }
@@ -843,8 +1193,11 @@ int createar_save_directory_wrapper(csavear *save, char *root, char *path, u64 *
 
 int createar_write_mainhead(csavear *save, int archtype, int fscount)
 {
-    u8 bufcheckclear[FSA_CHECKPASSBUF_SIZE+8];
-    u8 bufcheckcrypt[FSA_CHECKPASSBUF_SIZE+8];
+    u8 bufcheckclear[FSA_CHECKPASSBUF_SIZE+FSA_CRYPT_TAGSIZE];
+    u8 bufcheckcrypt[FSA_CHECKPASSBUF_SIZE+FSA_CRYPT_TAGSIZE];
+    u8 salt[FSA_CRYPT_SALTSIZE];
+    u8 key[FSA_CRYPT_KEYSIZE];
+    ccryptctx cryptctx;
     u64 cryptsize;
     u8 md5sum[16];
     struct timeval now;
@@ -875,25 +1228,43 @@ int createar_write_mainhead(csavear *save, int archtype, int fscount)
     dico_add_u32(d, 0, MAINHEADKEY_HASDIRSINFOHEAD, true);
     
     // minimum fsarchiver version required to restore that archive
-    dico_add_u64(d, 0, MAINHEADKEY_MINFSAVERSION, FSA_VERSION_BUILD(0, 6, 4, 0));
+    dico_add_u64(d, 0, MAINHEADKEY_MINFSAVERSION, FSA_VERSION_MINRESTORE);
     
     if (archtype==ARCHTYPE_FILESYSTEMS)
     {   
         dico_add_u64(d, 0, MAINHEADKEY_FSCOUNT, fscount);
     }
     
-    // if encryption is enabled, save the md5sum of a random buffer to check the password
+    // if encryption is enabled, derive the key of the archive from the password and a random salt (only once
+    // for all the blocks) and save the md5sum of a random buffer encrypted with nonce 0 to check the password
     if (g_options.encryptalgo!=ENCRYPT_NONE)
     {
+        crypto_random(salt, FSA_CRYPT_SALTSIZE);
+        if ((crypto_derive_key(g_options.encryptpass, strlen((char*)g_options.encryptpass), salt, FSA_CRYPT_SALTSIZE, FSA_CRYPT_KDFITER, key)!=0)
+            || (crypto_set_key(key)!=0))
+        {   errprintf("cannot derive the encryption key from the password\n");
+            dico_destroy(d);
+            return -1;
+        }
+        memset(key, 0, sizeof(key));
+        
         memset(md5sum, 0, sizeof(md5sum));
         crypto_random(bufcheckclear, FSA_CHECKPASSBUF_SIZE);
-        crypto_blowfish(FSA_CHECKPASSBUF_SIZE, &cryptsize, bufcheckclear, bufcheckcrypt, 
-            g_options.encryptpass, strlen((char*)g_options.encryptpass), true);
+        crypto_ctx_init(&cryptctx);
+        if (crypto_aes256gcm(FSA_CHECKPASSBUF_SIZE, &cryptsize, bufcheckclear, bufcheckcrypt, 0, NULL, 0, true, &cryptctx)!=0)
+        {   errprintf("cannot encrypt the buffer used to check the password\n");
+            crypto_ctx_destroy(&cryptctx);
+            dico_destroy(d);
+            return -1;
+        }
+        crypto_ctx_destroy(&cryptctx);
         
         gcry_md_hash_buffer(GCRY_MD_MD5, md5sum, bufcheckclear, FSA_CHECKPASSBUF_SIZE);
         
         assert(dico_add_data(d, 0, MAINHEADKEY_BUFCHECKPASSCLEARMD5, md5sum, 16)==0);
-        assert(dico_add_data(d, 0, MAINHEADKEY_BUFCHECKPASSCRYPTBUF, bufcheckcrypt, FSA_CHECKPASSBUF_SIZE)==0);
+        assert(dico_add_data(d, 0, MAINHEADKEY_BUFCHECKPASSCRYPTBUF, bufcheckcrypt, cryptsize)==0);
+        assert(dico_add_data(d, 0, MAINHEADKEY_CRYPTSALT, salt, FSA_CRYPT_SALTSIZE)==0);
+        dico_add_u32(d, 0, MAINHEADKEY_CRYPTKDFITER, FSA_CRYPT_KDFITER);
     }
     
     if (queue_add_header(&g_queue, d, FSA_MAGIC_MAIN, FSA_FILESYSID_NULL)!=0)
@@ -1044,6 +1415,11 @@ int filesystem_mount_partition(cdevinfo *devinfo, cdico *dicofsinfo, u16 fsid)
     fsbytestotal=(u64)statfsbuf.f_frsize*(u64)statfsbuf.f_blocks;
     fsbytesused=fsbytestotal-((u64)statfsbuf.f_frsize*(u64)statfsbuf.f_bfree);
     
+    // the cost of the files is estimated from the space and the inodes which are used (see createar_item_stdattr)
+    devinfo->cost=fsbytesused;
+    if (statfsbuf.f_files>statfsbuf.f_ffree)
+        devinfo->cost+=((u64)(statfsbuf.f_files-statfsbuf.f_ffree))*FSA_COST_PER_FILE;
+    
     dico_add_string(dicofsinfo, 0, FSYSHEADKEY_FILESYSTEM, filesys[devinfo->fstype].name);
     dico_add_string(dicofsinfo, 0, FSYSHEADKEY_MNTPATH, devinfo->partmount);
     dico_add_string(dicofsinfo, 0, FSYSHEADKEY_ORIGDEV, devinfo->devpath);
@@ -1062,6 +1438,7 @@ int createar_oper_savefs(csavear *save, cdevinfo *devinfo)
 {
     cdico *dicobegin=NULL;
     cdico *dicoend=NULL;
+    u64 coststart;
     int ret=0;
     
     // write "begin of filesystem" header
@@ -1075,8 +1452,12 @@ int createar_oper_savefs(csavear *save, cdevinfo *devinfo)
     save->fstype=devinfo->fstype;
     
     // main task
+    coststart=save->cost_current;
     ret=createar_save_directory_wrapper(save, devinfo->partmount, "/", NULL);
     
+    // the cost in the filesystem header may have been estimated: the real one is known now
+    save->cost_global=save->cost_global-devinfo->cost+(save->cost_current-coststart);
+    
     // write "end of filesystem" header
     if ((dicoend=dico_alloc())==NULL)
     {   errprintf("dicoend=dico_alloc() failed\n");
@@ -1118,7 +1499,9 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
     u64 totalerr=0;
     cdico *dicoend=NULL;
     cdico *dirsinfo=NULL;
+    cdico *dicodict=NULL;
     struct stat64 st;
+    u32 dictsize;
     csavear save;
     int ret=0;
     int i;
@@ -1169,9 +1552,16 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
     }
     
     // create compression threads
+    blkpool_set_max_memory(options_get_max_memory());
+    if ((queue_set_max_memory(&g_queue, options_get_max_memory())!=FSAERR_SUCCESS)
+        || (queue_set_workers(&g_queue, min(g_options.compressjobs, FSA_MAX_COMPJOBS))!=FSAERR_SUCCESS))
+    {   errprintf("cannot configure the queue\n");
+        ret=-1;
+        goto do_create_error;
+    }
     for (i=0; (i<g_options.compressjobs) && (i<FSA_MAX_COMPJOBS); i++)
     {
-        if (pthread_create(&thread_comp[i], NULL, thread_comp_fct, NULL) != 0)
+        if (pthread_create(&thread_comp[i], NULL, thread_comp_fct, (void*)(long)i) != 0)
         {   errprintf("pthread_create(thread_comp_fct) failed\n");
             ret=-1;
             goto do_create_error;
@@ -1216,13 +1606,19 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
         // analyse each filesystem and write its dico
         for (i=0; (i < argc) && (argv[i]); i++)
         {
-            // evaluate the cost of the operation
-            cost_evalfs=0;
-            msgprintf(MSG_VERB1, "Analysing filesystem on %s...\n", devinfo[i].devpath);
-            if (createar_save_directory_wrapper(&save, devinfo[i].partmount, "/", &cost_evalfs)!=0)
-            {   sysprintf("cannot run evaluation createar_save_directory(%s)\n", devinfo[i].partmount);
-                goto do_create_error;
+            // evaluate the cost of the operation: the filesystem is only walked twice when the small files have to
+            // be sampled to build the dictionary, else the cost is estimated from the statistics of the filesystem
+            if (g_options.compressdict==true)
+            {
+                cost_evalfs=0;
+                msgprintf(MSG_VERB1, "Analysing filesystem on %s...\n", devinfo[i].devpath);
+                if (createar_save_directory_wrapper(&save, devinfo[i].partmount, "/", &cost_evalfs)!=0)
+                {   sysprintf("cannot run evaluation createar_save_directory(%s)\n", devinfo[i].partmount);
+                    goto do_create_error;
+                }
+                devinfo[i].cost=cost_evalfs;
             }
+            cost_evalfs=devinfo[i].cost;
             if (dico_add_u64(dicofsinfo[i], 0, FSYSHEADKEY_TOTALCOST, cost_evalfs)!=0)
             {   errprintf("dico_add_u64(FSYSHEADKEY_TOTALCOST) failed\n");
                 goto do_create_error;
@@ -1270,6 +1666,27 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
         dirsinfo=NULL;
     }
     
+    // the blocks of small files are compressed with a dictionary built from the samples read during the analysis
+    if ((g_options.compressdict==true) && (g_options.encryptalgo!=ENCRYPT_NONE))
+    {   msgprintf(MSG_FORCE, "the dictionary is not used with encryption: it would store samples of the files in clear\n");
+    }
+    else if ((g_options.compressdict==true) && (compdict_build()==0) && (compdict_get(&dictsize)!=NULL))
+    {
+        if ((dicodict=dico_alloc())==NULL)
+        {   errprintf("dico_alloc() failed\n");
+            goto do_create_error;
+        }
+        if (compdict_write_header(dicodict)!=0)
+        {   errprintf("compdict_write_header() failed\n");
+            dico_destroy(dicodict);
+            goto do_create_error;
+        }
+        if (queue_add_header(&g_queue, dicodict, FSA_MAGIC_DICT, FSA_FILESYSID_NULL)!=0)
+        {   errprintf("queue_add_header(FSA_MAGIC_DICT) failed\n");
+            goto do_create_error;
+        }
+    }
+    
     // init counters to zero before real savefs/savedir
     save.cost_current=0;
     save.objectid=0;
@@ -1282,6 +1699,7 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
             {
                 msgprintf(MSG_VERB1, "============= archiving filesystem %s =============\n", devinfo[i].devpath);
                 save.fsid=i;
+                save.groupid=0; // filesystems can be restored alone: a group must not span two of them
                 memset(&save.stats, 0, sizeof(save.stats));
                 if (createar_oper_savefs(&save, &devinfo[i])!=0)
                 {   errprintf("archive_filesystem(%s) failed\n", devinfo[i].devpath);
@@ -23,6 +23,9 @@
 
 #include "fsarchiver.h"
 #include "options.h"
+#include "comp_zstd.h"
+#include "comp_lz4.h"
+#include "autolevel.h"
 #include "error.h"
 
 coptions g_options;
@@ -106,6 +109,91 @@ int options_select_compress_level(int opt)
             errprintf("invalid compression level: %d\n", opt);
             return -1;
     }
+    g_options.compressauto=false; // the last compression option wins (it may follow -z auto)
     
     return 0;
 }
+
+// memory budget of the queue: the value of --max-memory or a default which grows with the number of jobs
+u64 options_get_max_memory()
+{
+    if (g_options.maxmemory>0)
+        return g_options.maxmemory;
+    return max((u64)FSA_DEF_MAXMEMORY, (u64)g_options.compressjobs*FSA_DEF_MEMPERJOB);
+}
+
+// select zstd with a level between FSA_ZSTD_MINLEVEL and FSA_ZSTD_MAXLEVEL (option -Z)
+int options_select_zstd_level(int level)
+{
+#ifdef OPTION_ZSTD_SUPPORT
+    if (level<FSA_ZSTD_MINLEVEL || level>FSA_ZSTD_MAXLEVEL)
+    {   errprintf("invalid zstd compression level: %d\n", level);
+        return -1;
+    }
+    
+    g_options.fsacomplevel=0; // not one of the levels of option -z
+    g_options.compressauto=false;
+    g_options.compressalgo=COMPRESS_ZSTD;
+    g_options.compresslevel=level;
+    
+    // bigger blocks give zstd a chance to find matches far away like lzma
+    if (level>=FSA_ZSTD_LDMLEVEL)
+        g_options.datablocksize=FSA_MAX_BLKSIZE;
+    else if (level>=15)
+        g_options.datablocksize=524288;
+    else
+        g_options.datablocksize=FSA_DEF_BLKSIZE;
+    
+    return 0;
+#else
+    errprintf("zstd compression is not available: zstd has been disabled at compilation time\n");
+    return -1;
+#endif // OPTION_ZSTD_SUPPORT
+}
+
+// select lz4 with a level between FSA_LZ4_MINLEVEL and FSA_LZ4_MAXLEVEL (option -l)
+int options_select_lz4_level(int level)
+{
+#ifdef OPTION_LZ4_SUPPORT
+    if (level<FSA_LZ4_MINLEVEL || level>FSA_LZ4_MAXLEVEL)
+    {   errprintf("invalid lz4 compression level: %d\n", level);
+        return -1;
+    }
+    
+    g_options.fsacomplevel=0; // not one of the levels of option -z
+    g_options.compressauto=false;
+    g_options.compressalgo=COMPRESS_LZ4;
+    g_options.compresslevel=level;
+    g_options.datablocksize=FSA_DEF_BLKSIZE; // the lz4 window is 64KB: bigger blocks would not help
+    
+    return 0;
+#else
+    errprintf("lz4 compression is not available: lz4 has been disabled at compilation time\n");
+    return -1;
+#endif // OPTION_LZ4_SUPPORT
+}
+
+// let the compression threads adapt the algorithm and the level to the speed of the disks (option -z auto)
+int options_select_auto_level()
+{
+    int algo;
+    
+    // the main header records the algorithm and the level the controller starts with
+    if ((autolevel_init()!=0) || (autolevel_get(&algo, &g_options.compresslevel)!=0))
+        return -1;
+    
+    g_options.fsacomplevel=0; // not one of the levels of option -z
+    g_options.compressalgo=algo;
+    g_options.compressauto=true;
+    g_options.datablocksize=FSA_DEF_BLKSIZE; // all the algorithms must be able to use the same blocks
+    return 0;
+}
+
+// choose the compression of each large file from its type (option -t)
+int options_enable_comp_policy()
+{
+    if (g_options.compressauto==false && autolevel_init()!=0) // the fastest and the strongest algorithms
+        return -1;
+    g_options.comppolicy=true;
+    return 0;
+}
@@ -36,8 +36,15 @@ struct s_options
     u32      datablocksize;
     u32      smallfilethresh;
     u64      splitsize;
+    u64      maxmemory;
     u16      encryptalgo;
     u16      fsacomplevel;
+    bool     compressauto;
+    bool     comppolicy;
+    bool     compressdict;
+    bool     diskorder;
+    u32      solidblocks;
+    u16      csumalgo;
 	char     archlabel[FSA_MAX_LABELLEN];
     u8       encryptpass[FSA_MAX_PASSLEN+1];
     cstrlist exclude;
@@ -48,5 +55,10 @@ extern coptions g_options;
 int options_init();
 int options_destroy();
 int options_select_compress_level(int opt);
+int options_select_zstd_level(int level);
+int options_select_lz4_level(int level);
+int options_select_auto_level();
+int options_enable_comp_policy();
+u64 options_get_max_memory();
 
 #endif // __OPTIONS_H__
@@ -30,35 +30,197 @@
 
 #include "fsarchiver.h"
 #include "queue.h"
+#include "blkpool.h"
 #include "dico.h"
 #include "common.h"
 #include "syncthread.h"
+#include "options.h"
+#include "crypto.h"
 #include "error.h"
 
-struct timespec get_timeout()
+// returns the item which has a particular item number (the item must be in the queue)
+cqueueitem *queuelocked_item(cqueue *q, s64 itemnum)
 {
-    struct timespec t;
-    clock_gettime(CLOCK_REALTIME, &t);
-    t.tv_sec++;
-    return t;
+    return &q->ring[((u64)itemnum) & q->ringmask];
 }
 
-s64 queue_init(cqueue *q, s64 blkmax)
+// returns the first item of the queue or NULL if the queue is empty
+cqueueitem *queuelocked_head(cqueue *q)
 {
-    pthread_mutexattr_t attr;
+    if (q->itemcount<1)
+        return NULL;
+    return queuelocked_item(q, q->headnum);
+}
+
+// the queue is full when the new item would exceed the memory budget or when the ring has no free slot
+// (an item is always accepted when the queue is empty so that a single big block cannot block it)
+bool queuelocked_is_full(cqueue *q, u64 memsize)
+{
+    return (((q->itemcount>0) && (q->memcount+memsize > q->memmax)) || (q->itemcount >= q->ringsize));
+}
+
+// memory used by a block from the time it's added until it's removed from the queue: the buffer it comes
+// with, the buffer allocated by the compression thread, and one more buffer if the block has to be encrypted
+u64 queue_block_memory(cblockinfo *blkinfo)
+{
+    u64 bufsize;
+    u64 total;
+    
+    if (blkinfo->blkdata==NULL) // blocks of zeros have no buffer when they are saved
+        return 0;
+    
+    bufsize=max((u64)blkinfo->blkarsize, (u64)blkinfo->blkrealsize + (blkinfo->blkrealsize / 16) + 64 + 3);
+    total=blkinfo->blkrealsize+bufsize;
+    if ((blkinfo->blkcryptalgo>ENCRYPT_NONE) || (g_options.encryptalgo>ENCRYPT_NONE))
+        total+=bufsize+FSA_CRYPT_TAGSIZE;
+    return total;
+}
+
+// wake up every thread that waits on the queue (used when a waiter may have to exit)
+void queuelocked_wakeup_all(cqueue *q)
+{
+    pthread_cond_broadcast(&q->condnotfull);
+    pthread_cond_broadcast(&q->conddone);
+    
+    // compression threads only wait for new blocks so they just have to know when to exit
+    if ((q->itemcount<1) && (q->endofqueue==true))
+    {   assert(pthread_mutex_lock(&q->idlemutex)==0);
+        q->finished=true;
+        pthread_cond_broadcast(&q->condidle);
+        assert(pthread_mutex_unlock(&q->idlemutex)==0);
+    }
+}
+
+// blocks of a solid group are compressed as one stream: only the thread which owns their list can process them
+bool queue_jobs_stealable(cqueue *q, s64 itemnum)
+{
+    return (q->ring[((u64)itemnum) & q->ringmask].blkinfo.blkgroupid==0);
+}
+
+// take the oldest item number of a list of blocks to process (returns 0 if the list is empty or if
+// the oldest block belongs to a solid group and the caller does not own the list)
+s64 queue_jobs_pop(cqueue *q, cqueuejobs *jobs, bool steal)
+{
+    s64 itemnum=0;
+    
+    assert(pthread_mutex_lock(&jobs->mutex)==0);
+    if ((jobs->count>0) && ((steal==false) || (queue_jobs_stealable(q, jobs->itemnums[jobs->first])==true)))
+    {   itemnum=jobs->itemnums[jobs->first];
+        jobs->first=(jobs->first+1) % jobs->size;
+        jobs->count--;
+    }
+    assert(pthread_mutex_unlock(&jobs->mutex)==0);
+    
+    return itemnum;
+}
+
+// true if queue_jobs_pop() would return a block
+bool queue_jobs_available(cqueue *q, cqueuejobs *jobs, bool steal)
+{
+    bool res;
+    
+    assert(pthread_mutex_lock(&jobs->mutex)==0);
+    res=((jobs->count>0) && ((steal==false) || (queue_jobs_stealable(q, jobs->itemnums[jobs->first])==true)));
+    assert(pthread_mutex_unlock(&jobs->mutex)==0);
+    
+    return res;
+}
+
+void queue_jobs_free(cqueuejobs *jobs, int count)
+{
+    int i;
+    
+    for (i=0; (jobs!=NULL) && (i<count); i++)
+    {
+        free(jobs[i].itemnums);
+        assert(pthread_mutex_destroy(&jobs[i].mutex)==0);
+    }
+    free(jobs);
+}
+
+// give a new block to the compression threads (round robin): idle threads will steal it if its owner is busy,
+// except for the blocks of a solid group which all go to the same thread in the order of the queue
+void queuelocked_push_job(cqueue *q, s64 itemnum)
+{
+    cqueuejobs *jobs;
+    bool added=false;
+    u64 groupid;
+    int i;
+    
+    groupid=queuelocked_item(q, itemnum)->blkinfo.blkgroupid;
+    for (i=0; (i<q->jobscount) && (added==false); i++)
+    {
+        if (groupid!=0)
+            jobs=&q->jobs[groupid % q->jobscount];
+        else
+        {   jobs=&q->jobs[q->nextjobs];
+            q->nextjobs=(q->nextjobs+1) % q->jobscount;
+        }
+        assert(pthread_mutex_lock(&jobs->mutex)==0);
+        if (jobs->count < jobs->size)
+        {   jobs->itemnums[(jobs->first+jobs->count) % jobs->size]=itemnum;
+            jobs->count++;
+            added=true;
+        }
+        assert(pthread_mutex_unlock(&jobs->mutex)==0);
+    }
+    
+    if (added==false) // should never happen: each list can hold as many items as the ring
+    {   errprintf("cannot add block %ld to the lists of blocks to process\n", (long)itemnum);
+        return;
+    }
+    
+    // only take the idle mutex when a thread is waiting (the counter is incremented before threads check their lists)
+    // and wake them all when only the owner of the list can take the block
+    if (__sync_fetch_and_add(&q->idlecount, 0)>0)
+    {   assert(pthread_mutex_lock(&q->idlemutex)==0);
+        if (groupid!=0)
+            pthread_cond_broadcast(&q->condidle);
+        else
+            pthread_cond_signal(&q->condidle);
+        assert(pthread_mutex_unlock(&q->idlemutex)==0);
+    }
+}
+
+// a thread becomes the owner of a block when it changes claimnum: it fails if another thread took it first
+bool queue_claim_block(cqueue *q, s64 itemnum)
+{
+    return __sync_bool_compare_and_swap(&q->ring[((u64)itemnum) & q->ringmask].claimnum, itemnum, 0);
+}
 
+s64 queue_init(cqueue *q, u64 memmax)
+{
+    pthread_mutexattr_t attr;
+    
     if (!q)
     {   errprintf("q is NULL\n");
         return FSAERR_EINVAL;
     }
     
+    // ---- allocate the ring
+    q->ringsize=FSA_MAX_QUEUEITEMS;
+    q->ringmask=q->ringsize-1;
+    if ((q->ring=malloc(q->ringsize*sizeof(cqueueitem)))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)(q->ringsize*sizeof(cqueueitem)));
+        return FSAERR_ENOMEM;
+    }
+    
     // ---- init default attributes
-    q->head=NULL;
     q->curitemnum=1;
+    q->headnum=1;
     q->itemcount=0;
     q->blkcount=0;
-    q->blkmax=blkmax;
+    q->memcount=0;
+    q->memmax=memmax;
     q->endofqueue=false;
+    q->jobs=NULL;
+    q->jobscount=0;
+    q->nextjobs=0;
+    q->idlecount=0;
+    q->finished=false;
+    q->compstalls=0;
+    q->outputstalls=0;
+    q->idlestalls=0;
     
     // ---- init pthread structures
     assert(pthread_mutexattr_init(&attr)==0);
@@ -68,19 +230,83 @@ s64 queue_init(cqueue *q, s64 blkmax)
         return FSAERR_UNKNOWN;
     }
     
-    if (pthread_cond_init(&q->cond,NULL)!=0)
+    if (pthread_mutex_init(&q->idlemutex, &attr)!=0)
+    {   msgprintf(3, "pthread_mutex_init failed\n");
+        return FSAERR_UNKNOWN;
+    }
+    
+    if ((pthread_cond_init(&q->condnotfull, NULL)!=0) || (pthread_cond_init(&q->conddone, NULL)!=0)
+        || (pthread_cond_init(&q->condidle, NULL)!=0))
     {   msgprintf(3, "pthread_cond_init failed\n");
         return FSAERR_UNKNOWN;
     }
     
+    // ---- there is at least one compression thread
+    return queue_set_workers(q, 1);
+}
+
+// create one list of blocks per compression thread (must be called before the compression threads start)
+s64 queue_set_workers(cqueue *q, int count)
+{
+    cqueuejobs *jobs;
+    cqueuejobs *oldjobs;
+    int oldcount;
+    int i;
+    
+    if (!q || count<1)
+    {   errprintf("invalid parameters\n");
+        return FSAERR_EINVAL;
+    }
+    
+    if ((jobs=malloc(count*sizeof(cqueuejobs)))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)(count*sizeof(cqueuejobs)));
+        return FSAERR_ENOMEM;
+    }
+    
+    for (i=0; i<count; i++)
+    {
+        jobs[i].size=q->ringsize;
+        jobs[i].first=0;
+        jobs[i].count=0;
+        if ((jobs[i].itemnums=malloc(jobs[i].size*sizeof(s64)))==NULL)
+        {   errprintf("malloc(%ld) failed: out of memory\n", (long)(jobs[i].size*sizeof(s64)));
+            queue_jobs_free(jobs, i);
+            return FSAERR_ENOMEM;
+        }
+        assert(pthread_mutex_init(&jobs[i].mutex, NULL)==0);
+    }
+    
+    assert(pthread_mutex_lock(&q->mutex)==0);
+    oldjobs=q->jobs;
+    oldcount=q->jobscount;
+    q->jobs=jobs;
+    q->jobscount=count;
+    q->nextjobs=0;
+    assert(pthread_mutex_unlock(&q->mutex)==0);
+    
+    queue_jobs_free(oldjobs, oldcount);
+    
+    return FSAERR_SUCCESS;
+}
+
+// how many bytes the blocks and headers in the queue can use before producers have to wait
+s64 queue_set_max_memory(cqueue *q, u64 memmax)
+{
+    if (!q || memmax<1)
+    {   errprintf("invalid parameters\n");
+        return FSAERR_EINVAL;
+    }
+    
+    assert(pthread_mutex_lock(&q->mutex)==0);
+    q->memmax=memmax;
+    pthread_cond_broadcast(&q->condnotfull);
+    assert(pthread_mutex_unlock(&q->mutex)==0);
+    
     return FSAERR_SUCCESS;
 }
 
 s64 queue_destroy(cqueue *q)
 {
-    cqueueitem *cur;
-    cqueueitem *next;
-    
     if (!q)
     {   errprintf("q is NULL\n");
         return FSAERR_EINVAL;
@@ -88,18 +314,21 @@ s64 queue_destroy(cqueue *q)
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
-    for (cur=q->head; cur!=NULL; cur=next)
-    {
-        next=cur->next;
-        free(cur);
-    }
-    q->head=NULL;
+    free(q->ring);
+    q->ring=NULL;
+    q->headnum=q->curitemnum;
     q->itemcount=0;
+    queue_jobs_free(q->jobs, q->jobscount);
+    q->jobs=NULL;
+    q->jobscount=0;
     
     assert(pthread_mutex_unlock(&q->mutex)==0);
     
     assert(pthread_mutex_destroy(&q->mutex)==0);
-    assert(pthread_cond_destroy(&q->cond)==0);
+    assert(pthread_mutex_destroy(&q->idlemutex)==0);
+    assert(pthread_cond_destroy(&q->condnotfull)==0);
+    assert(pthread_cond_destroy(&q->conddone)==0);
+    assert(pthread_cond_destroy(&q->condidle)==0);
     
     return FSAERR_SUCCESS;
 }
@@ -113,8 +342,8 @@ s64 queue_set_end_of_queue(cqueue *q, bool state)
 
     assert(pthread_mutex_lock(&q->mutex)==0);
     q->endofqueue=state;
+    queuelocked_wakeup_all(q);
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    pthread_cond_broadcast(&q->cond);
     return FSAERR_SUCCESS;
 }
 
@@ -144,6 +373,25 @@ bool queuelocked_get_end_of_queue(cqueue *q)
     return res;
 }
 
+// remove the first item of the queue (the caller already made a copy of it)
+void queuelocked_remove_head(cqueue *q)
+{
+    cqueueitem *cur;
+    
+    cur=queuelocked_head(q);
+    if (cur->type==QITEM_TYPE_BLOCK)
+        q->blkcount--;
+    q->memcount-=cur->memsize;
+    q->headnum++;
+    q->itemcount--;
+    
+    // a producer may be waiting for free space, and all threads must exit at the end of the queue
+    if (queuelocked_get_end_of_queue(q)==true)
+        queuelocked_wakeup_all(q);
+    else
+        pthread_cond_signal(&q->condnotfull);
+}
+
 // runs with the mutex unlocked (external users)
 s64 queue_count(cqueue *q)
 {
@@ -166,6 +414,7 @@ s64 queue_count_status(cqueue *q, int status)
 {
     cqueueitem *cur;
     int count=0;
+    s64 i;
     
     if (!q)
     {   errprintf("q is NULL\n");
@@ -174,8 +423,9 @@ s64 queue_count_status(cqueue *q, int status)
 
     assert(pthread_mutex_lock(&q->mutex)==0);
     
-    for (cur=q->head; cur!=NULL; cur=cur->next)
+    for (i=q->headnum; i < q->curitemnum; i++)
     {
+        cur=queuelocked_item(q, i);
         if (status==QITEM_STATUS_NULL || cur->status==status)
             count++;
     }
@@ -185,27 +435,11 @@ s64 queue_count_status(cqueue *q, int status)
     return count;
 }
 
-// add a block at the end of the queue
-s64 queue_add_block(cqueue *q, cblockinfo *blkinfo, int status)
+// add an item at the end of the queue (the tail is always at q->curitemnum)
+s64 queue_add_item_internal(cqueue *q, cqueueitem *item)
 {
-    cqueueitem *item;
     cqueueitem *cur;
-    
-    if (!q || !blkinfo)
-    {   errprintf("a parameter is NULL\n");
-        return FSAERR_EINVAL;
-    }
-    
-    // create the new item in memory
-    item=malloc(sizeof(cqueueitem));
-    if (!item)
-    {   errprintf("malloc(%ld) failed: out of memory\n", (long)sizeof(cqueueitem));
-        return FSAERR_ENOMEM;
-    }
-    item->type=QITEM_TYPE_BLOCK;
-    item->status=status;
-    item->blkinfo=*blkinfo;
-    item->next=NULL;
+    bool wasempty;
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
@@ -215,32 +449,62 @@ s64 queue_add_block(cqueue *q, cblockinfo *blkinfo, int status)
         return FSAERR_ENDOFFILE;
     }
     
+    // the queue is full although its head is ready: the writer is the bottleneck
+    if ((queuelocked_is_full(q, item->memsize)==true) && (queuelocked_head(q)!=NULL) && (queuelocked_head(q)->status==QITEM_STATUS_DONE))
+        q->outputstalls++;
+    
     // wait while (queue-is-full) to let the other threads remove items first
-    while (q->blkcount > q->blkmax)
-    {
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+    while ((queuelocked_is_full(q, item->memsize)==true) && (q->endofqueue==false))
+        pthread_cond_wait(&q->condnotfull, &q->mutex);
     
-    if (q->head==NULL) // if list empty: item is head
-    {
-        q->head=item;
-    }
-    else // list not empty: add items at the end
-    {   for (cur=q->head; (cur!=NULL) && (cur->next!=NULL); cur=cur->next);
-        cur->next=item;
+    if (q->endofqueue==true)
+    {   assert(pthread_mutex_unlock(&q->mutex)==0);
+        return FSAERR_ENDOFFILE;
     }
     
-    q->blkcount++;
-    q->itemcount++;
     item->itemnum=q->curitemnum++;
+    item->claimnum=((item->type==QITEM_TYPE_BLOCK) && (item->status==QITEM_STATUS_TODO)) ? item->itemnum : 0;
+    cur=queuelocked_item(q, item->itemnum);
+    *cur=*item;
+    
+    wasempty=(q->itemcount==0);
+    if (cur->type==QITEM_TYPE_BLOCK)
+        q->blkcount++;
+    q->memcount+=cur->memsize;
+    q->itemcount++;
+    
+    // give the new block to a compression thread
+    if (cur->claimnum!=0)
+        queuelocked_push_job(q, cur->itemnum);
+    
+    // the new item is the head: the thread which consumes the queue may be waiting for it
+    if (wasempty==true)
+        pthread_cond_broadcast(&q->conddone);
     
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    pthread_cond_broadcast(&q->cond);
     
     return FSAERR_SUCCESS;
 }
 
+// add a block at the end of the queue
+s64 queue_add_block(cqueue *q, cblockinfo *blkinfo, int status)
+{
+    cqueueitem item;
+    
+    if (!q || !blkinfo)
+    {   errprintf("a parameter is NULL\n");
+        return FSAERR_EINVAL;
+    }
+    
+    memset(&item, 0, sizeof(item));
+    item.type=QITEM_TYPE_BLOCK;
+    item.status=status;
+    item.blkinfo=*blkinfo;
+    item.memsize=queue_block_memory(blkinfo);
+    
+    return queue_add_item_internal(q, &item);
+}
+
 s64 queue_add_header(cqueue *q, cdico *d, char *magic, u16 fsid)
 {
     cheadinfo headinfo;
@@ -260,56 +524,20 @@ s64 queue_add_header(cqueue *q, cdico *d, char *magic, u16 fsid)
 
 s64 queue_add_header_internal(cqueue *q, cheadinfo *headinfo)
 {
-    cqueueitem *item;
-    cqueueitem *cur;
+    cqueueitem item;
     
     if (!q || !headinfo)
     {   errprintf("parameter is null\n");
         return FSAERR_EINVAL;
     }
     
-    // create the new item in memory
-    item=malloc(sizeof(cqueueitem));
-    if (!item)
-    {   errprintf("malloc(%ld) failed: out of memory 1\n", (long)sizeof(cqueueitem));
-        return FSAERR_ENOMEM;
-    }
-    
-    item->headinfo=*headinfo;
-    item->type=QITEM_TYPE_HEADER;
-    item->status=QITEM_STATUS_DONE;
-    item->next=NULL;
-    
-    assert(pthread_mutex_lock(&q->mutex)==0);
-    
-    // does not make sense to add item on a queue where endofqueue is true
-    if (q->endofqueue==true)
-    {   assert(pthread_mutex_unlock(&q->mutex)==0);
-        return FSAERR_ENDOFFILE;
-    }
-    
-    // wait while (queue-is-full) to let the other threads remove items first
-    while (q->blkcount > q->blkmax)
-    {
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
-    
-    item->itemnum=q->curitemnum++;
-    if (q->head==NULL) // if list empty
-    {
-        q->head=item;
-    }
-    else // list not empty
-    {   for (cur=q->head; (cur!=NULL) && (cur->next!=NULL); cur=cur->next);
-        cur->next=item;
-    }
-    
-    q->itemcount++;
-    assert(pthread_mutex_unlock(&q->mutex)==0);
-    pthread_cond_broadcast(&q->cond);
+    memset(&item, 0, sizeof(item));
+    item.headinfo=*headinfo;
+    item.type=QITEM_TYPE_HEADER;
+    item.status=QITEM_STATUS_DONE;
+    item.memsize=dico_get_memory(headinfo->dico);
     
-    return FSAERR_SUCCESS;
+    return queue_add_item_internal(q, &item);
 }
 
 // function called by the compression thread when a block has been compressed
@@ -324,26 +552,27 @@ s64 queue_replace_block(cqueue *q, s64 itemnum, cblockinfo *blkinfo, int newstat
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
-    if (q->head==NULL)
+    if (q->itemcount<1)
     {   assert(pthread_mutex_unlock(&q->mutex)==0);
-        msgprintf(MSG_DEBUG1, "q->head is NULL: list is empty\n");
+        msgprintf(MSG_DEBUG1, "the queue is empty\n");
         return FSAERR_ENOENT; // item not found
     }
     
-    for (cur=q->head; cur!=NULL; cur=cur->next)
-    {
-        if (cur->itemnum==itemnum) // block found
-        {
-            cur->status=newstatus;
-            cur->blkinfo=*blkinfo;
-            assert(pthread_mutex_unlock(&q->mutex)==0);
-            pthread_cond_broadcast(&q->cond);
-            return FSAERR_SUCCESS;
-        }
+    // the item may have been removed from the queue in the meantime (after an error)
+    if ((itemnum < q->headnum) || (itemnum >= q->curitemnum) || ((cur=queuelocked_item(q, itemnum))->itemnum!=itemnum))
+    {   assert(pthread_mutex_unlock(&q->mutex)==0);
+        return FSAERR_ENOENT; // not found
     }
     
+    cur->status=newstatus;
+    cur->blkinfo=*blkinfo;
+    
+    // the thread which consumes the queue only waits for the head
+    if (itemnum==q->headnum)
+        pthread_cond_broadcast(&q->conddone);
+    
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    return FSAERR_ENOENT; // not found
+    return FSAERR_SUCCESS;
 }
 
 // get number of items to be processed
@@ -351,6 +580,7 @@ s64 queue_count_items_todo(cqueue *q)
 {
     cqueueitem *cur;
     s64 count=0;
+    s64 i;
     
     if (!q)
     {   errprintf("a parameter is null\n");
@@ -359,8 +589,9 @@ s64 queue_count_items_todo(cqueue *q)
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
-    for (cur=q->head; cur!=NULL; cur=cur->next)
+    for (i=q->headnum; i < q->curitemnum; i++)
     {
+        cur=queuelocked_item(q, i);
         if ((cur->type==QITEM_TYPE_BLOCK) && (cur->status!=QITEM_STATUS_DONE))
             count++;
     }
@@ -370,50 +601,66 @@ s64 queue_count_items_todo(cqueue *q)
     return count;
 }
 
-// the compression thread requires the first block which has not yet been compressed
-s64 queue_get_first_block_todo(cqueue *q, cblockinfo *blkinfo)
+// how many times the threads had to wait since the queue was created (used to adapt the compression level)
+s64 queue_get_stalls(cqueue *q, u64 *compstalls, u64 *outputstalls, u64 *idlestalls)
 {
-    cqueueitem *cur;
-    s64 itemfound=-1;
-    int res;
-    
-    if (!q || !blkinfo)
+    if (!q || !compstalls || !outputstalls || !idlestalls)
     {   errprintf("a parameter is null\n");
         return FSAERR_EINVAL;
     }
     
     assert(pthread_mutex_lock(&q->mutex)==0);
+    *compstalls=q->compstalls;
+    *outputstalls=q->outputstalls;
+    assert(pthread_mutex_unlock(&q->mutex)==0);
+    *idlestalls=__sync_fetch_and_add(&q->idlestalls, 0);
     
-    while (queuelocked_get_end_of_queue(q)==false)
+    return FSAERR_SUCCESS;
+}
+
+// the compression thread requires a block which has not yet been compressed: it takes the oldest
+// block of its own list first and steals from the lists of the other threads when it's empty
+s64 queue_get_block_todo(cqueue *q, int worker, cblockinfo *blkinfo)
+{
+    s64 itemnum;
+    bool found;
+    int i;
+    
+    if (!q || !blkinfo || worker<0)
+    {   errprintf("invalid parameters\n");
+        return FSAERR_EINVAL;
+    }
+    
+    while (true)
     {
-        for (cur=q->head; cur!=NULL; cur=cur->next)
+        for (i=0; i<q->jobscount; i++)
         {
-            if ((cur->type==QITEM_TYPE_BLOCK) && (cur->status==QITEM_STATUS_TODO))
+            while ((itemnum=queue_jobs_pop(q, &q->jobs[(worker+i) % q->jobscount], (i>0)))>0)
             {
-                *blkinfo=cur->blkinfo;
-                cur->status=QITEM_STATUS_PROGRESS;
-                itemfound=cur->itemnum;
-                assert(pthread_mutex_unlock(&q->mutex)==0);
-                pthread_cond_broadcast(&q->cond);
-                return itemfound; // ">0" means item found
+                // the item can't be removed from the queue before it has been replaced once it's claimed
+                if (queue_claim_block(q, itemnum)==true)
+                {   *blkinfo=q->ring[((u64)itemnum) & q->ringmask].blkinfo;
+                    return itemnum; // ">0" means item found
+                }
             }
         }
         
-        struct timespec t=get_timeout();
-        if ((res=pthread_cond_timedwait(&q->cond, &q->mutex, &t))!=0 && res!=ETIMEDOUT)
-        {   assert(pthread_mutex_unlock(&q->mutex)==0);
-            return FSAERR_UNKNOWN;
+        // nothing to do: check the lists again after incrementing idlecount so that a new block cannot be missed
+        assert(pthread_mutex_lock(&q->idlemutex)==0);
+        __sync_fetch_and_add(&q->idlecount, 1);
+        for (found=false, i=0; (i<q->jobscount) && (found==false); i++)
+            found=queue_jobs_available(q, &q->jobs[(worker+i) % q->jobscount], (i>0));
+        if ((found==false) && (q->finished==false))
+        {   __sync_fetch_and_add(&q->idlestalls, 1);
+            pthread_cond_wait(&q->condidle, &q->idlemutex);
         }
-        
+        __sync_fetch_and_sub(&q->idlecount, 1);
+        if (q->finished==true)
+        {   assert(pthread_mutex_unlock(&q->idlemutex)==0);
+            return FSAERR_ENDOFFILE;
+        }
+        assert(pthread_mutex_unlock(&q->idlemutex)==0);
     }
-    
-    // if it failed at the other end of the queue
-    assert(pthread_mutex_unlock(&q->mutex)==0);
-    
-    if (queuelocked_get_end_of_queue(q))
-        return FSAERR_ENDOFFILE;
-    else
-        return FSAERR_UNKNOWN;
 }
 
 // the writer thread requires the first block of the queue if it ready to go
@@ -421,6 +668,7 @@ s64 queue_get_first_block_todo(cqueue *q, cblockinfo *blkinfo)
 s64 queue_dequeue_first(cqueue *q, int *type, cheadinfo *headinfo, cblockinfo *blkinfo)
 {
     cqueueitem *cur=NULL;
+    bool stalled=false;
     s64 itemfound=-1;
     int ret;
     
@@ -433,19 +681,15 @@ s64 queue_dequeue_first(cqueue *q, int *type, cheadinfo *headinfo, cblockinfo *b
     
     while (queuelocked_get_end_of_queue(q)==false)
     {
-        if (((cur=q->head)!=NULL) && (cur->status==QITEM_STATUS_DONE))
+        if (((cur=queuelocked_head(q))!=NULL) && (cur->status==QITEM_STATUS_DONE))
         {
             if (cur->type==QITEM_TYPE_BLOCK) // item to dequeue is a block
             {
-                q->blkcount--;
                 *type=cur->type;
                 itemfound=cur->itemnum;
                 *blkinfo=cur->blkinfo;
-                q->head=cur->next;
-                free(cur);
-                q->itemcount--;
+                queuelocked_remove_head(q);
                 assert(pthread_mutex_unlock(&q->mutex)==0);
-                pthread_cond_broadcast(&q->cond);
                 return itemfound; // ">0" means item found
             }
             else if (cur->type==QITEM_TYPE_HEADER) // item to dequeue is a dico
@@ -453,11 +697,8 @@ s64 queue_dequeue_first(cqueue *q, int *type, cheadinfo *headinfo, cblockinfo *b
                 *headinfo=cur->headinfo;
                 *type=cur->type;
                 itemfound=cur->itemnum;
-                q->head=cur->next;
-                free(cur);
-                q->itemcount--;
+                queuelocked_remove_head(q);
                 assert(pthread_mutex_unlock(&q->mutex)==0);
-                pthread_cond_broadcast(&q->cond);
                 return itemfound; // ">0" means item found
             }
             else
@@ -468,8 +709,13 @@ s64 queue_dequeue_first(cqueue *q, int *type, cheadinfo *headinfo, cblockinfo *b
             }
         }
         
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
+        // the head is there but it's not compressed yet: the compression threads are the bottleneck
+        if ((cur!=NULL) && (stalled==false))
+        {   q->compstalls++;
+            stalled=true;
+        }
+        
+        pthread_cond_wait(&q->conddone, &q->mutex);
     }
     
     // if it failed at the other end of the queue
@@ -493,11 +739,8 @@ s64 queue_dequeue_block(cqueue *q, cblockinfo *blkinfo)
     assert(pthread_mutex_lock(&q->mutex)==0);
     
     // while ((first-item-of-the-queue-is-not-ready) && (not-at-the-end-of-the-queue))
-    while ( (((cur=q->head)==NULL) || (cur->status!=QITEM_STATUS_DONE)) && (queuelocked_get_end_of_queue(q)==false) )
-    {
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+    while ( (((cur=queuelocked_head(q))==NULL) || (cur->status!=QITEM_STATUS_DONE)) && (queuelocked_get_end_of_queue(q)==false) )
+        pthread_cond_wait(&q->conddone, &q->mutex);
     
     // if it failed at the other end of the queue
     if (queuelocked_get_end_of_queue(q))
@@ -506,26 +749,21 @@ s64 queue_dequeue_block(cqueue *q, cblockinfo *blkinfo)
     }
     
     // should not happen since queuelocked_is_first_block_ready means there is at least one block in the queue
-    assert((cur=q->head)!=NULL);
+    assert((cur=queuelocked_head(q))!=NULL);
     
     // test the first item
     if ((cur->type==QITEM_TYPE_BLOCK) && (cur->status==QITEM_STATUS_DONE))
     {
         *blkinfo=cur->blkinfo;
-        q->head=cur->next;
         itemnum=cur->itemnum;
-        free(cur);
-        q->blkcount--;
-        q->itemcount--;
+        queuelocked_remove_head(q);
         assert(pthread_mutex_unlock(&q->mutex)==0);
-        pthread_cond_broadcast(&q->cond);
         return itemnum;
     }
     else
     {
         errprintf("dequeue - wrong type of data in the queue: wanted a block, found an header\n");
         assert(pthread_mutex_unlock(&q->mutex)==0);
-        pthread_cond_broadcast(&q->cond);
         return FSAERR_WRONGTYPE;  // ok but not found
     }
 }
@@ -565,11 +803,8 @@ s64 queue_dequeue_header_internal(cqueue *q, cheadinfo *headinfo)
     assert(pthread_mutex_lock(&q->mutex)==0);
     
     // while ((first-item-of-the-queue-is-not-ready) && (not-at-the-end-of-the-queue))
-    while ( (((cur=q->head)==NULL) || (cur->status!=QITEM_STATUS_DONE)) && (queuelocked_get_end_of_queue(q)==false) )
-    {
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+    while ( (((cur=queuelocked_head(q))==NULL) || (cur->status!=QITEM_STATUS_DONE)) && (queuelocked_get_end_of_queue(q)==false) )
+        pthread_cond_wait(&q->conddone, &q->mutex);
     
     // if it failed at the other end of the queue
     if (queuelocked_get_end_of_queue(q))
@@ -578,29 +813,24 @@ s64 queue_dequeue_header_internal(cqueue *q, cheadinfo *headinfo)
     }
     
     // should not happen since queuelocked_is_first_block_ready means there is at least one block in the queue
-    assert ((cur=q->head)!=NULL);
+    assert ((cur=queuelocked_head(q))!=NULL);
     
     // test the first item
     switch (cur->type)
     {
         case QITEM_TYPE_HEADER:
-            q->head=cur->next;
             *headinfo=cur->headinfo;
             itemnum=cur->itemnum;
-            free(cur);
-            q->itemcount--;
+            queuelocked_remove_head(q);
             assert(pthread_mutex_unlock(&q->mutex)==0);
-            pthread_cond_broadcast(&q->cond);
             return itemnum;
         case QITEM_TYPE_BLOCK:
             errprintf("dequeue - wrong type of data in the queue: expected a dico and found a block\n");
             assert(pthread_mutex_unlock(&q->mutex)==0);
-            pthread_cond_broadcast(&q->cond);
             return FSAERR_WRONGTYPE;  // ok but not found
         default: // should never happen
             errprintf("dequeue - wrong type of data in the queue: expected a dico and found an unknown item\n");
             assert(pthread_mutex_unlock(&q->mutex)==0);
-            pthread_cond_broadcast(&q->cond);
             return FSAERR_WRONGTYPE;  // ok but not found
     }
 }
@@ -615,7 +845,7 @@ bool queuelocked_is_first_item_ready(cqueue *q)
         return false; // not found
     }
     
-    if ((cur=q->head)==NULL)
+    if ((cur=queuelocked_head(q))==NULL)
         return false; // list empty
     else if (cur->type==QITEM_TYPE_HEADER)
         return true; // a dico is always ready
@@ -641,11 +871,8 @@ s64 queue_check_next_item(cqueue *q, int *type, char *magic)
     assert(pthread_mutex_lock(&q->mutex)==0);
     
     // while ((first-item-of-the-queue-is-not-ready) && (not-at-the-end-of-the-queue))
-    while ( (((cur=q->head)==NULL) || (cur->status!=QITEM_STATUS_DONE)) && (queuelocked_get_end_of_queue(q)==false) )
-    {
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+    while ( (((cur=queuelocked_head(q))==NULL) || (cur->status!=QITEM_STATUS_DONE)) && (queuelocked_get_end_of_queue(q)==false) )
+        pthread_cond_wait(&q->conddone, &q->mutex);
     
     // if it failed at the other end of the queue
     if (queuelocked_get_end_of_queue(q))
@@ -654,7 +881,7 @@ s64 queue_check_next_item(cqueue *q, int *type, char *magic)
     }
     
     // test the first item
-    if (((cur=q->head)!=NULL) && (cur->status==QITEM_STATUS_DONE))
+    if (((cur=queuelocked_head(q))!=NULL) && (cur->status==QITEM_STATUS_DONE))
     {
         if (cur->type==QITEM_TYPE_BLOCK) // item to dequeue is a block
         {
@@ -679,11 +906,19 @@ s64 queue_check_next_item(cqueue *q, int *type, char *magic)
     }
     
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    pthread_cond_broadcast(&q->cond);
     
     return FSAERR_ENOENT;  // not found
 }
 
+// a block which is still waiting for a compression thread must be claimed before it can be destroyed
+bool queuelocked_take_head_block(cqueue *q, cqueueitem *cur)
+{
+    if ((cur->type!=QITEM_TYPE_BLOCK) || (cur->status==QITEM_STATUS_DONE))
+        return true;
+    // claimnum is zero when a compression thread is processing the block: wait until it has been replaced
+    return ((cur->claimnum!=0) && (queue_claim_block(q, cur->itemnum)==true));
+}
+
 // destroy the first item in the queue (similar to dequeue but do not read it)
 s64 queue_destroy_first_item(cqueue *q)
 {
@@ -697,10 +932,8 @@ s64 queue_destroy_first_item(cqueue *q)
     assert(pthread_mutex_lock(&q->mutex)==0);
     
     // while ((first-item-of-the-queue-is-not-ready or first-item-is-being-processed-by-comp-thread) && (not-at-the-end-of-the-queue))
-    while ( (((cur=q->head)==NULL) || (cur->status==QITEM_STATUS_PROGRESS)) && (queuelocked_get_end_of_queue(q)==false) )
-    {   struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+    while ( (((cur=queuelocked_head(q))==NULL) || (queuelocked_take_head_block(q, cur)==false)) && (queuelocked_get_end_of_queue(q)==false) )
+        pthread_cond_wait(&q->conddone, &q->mutex);
     
     // if it failed at the other end of the queue
     if (queuelocked_get_end_of_queue(q))
@@ -709,23 +942,19 @@ s64 queue_destroy_first_item(cqueue *q)
     }
     
     // should not happen since queuelocked_is_first_block_ready means there is at least one block in the queue
-    assert((cur=q->head)!=NULL);
+    assert((cur=queuelocked_head(q))!=NULL);
     
     switch (cur->type)
     {
         case QITEM_TYPE_BLOCK:
-            q->blkcount--;
-            free(cur->blkinfo.blkdata);
+            blkpool_free(cur->blkinfo.blkdata);
             break;
         case QITEM_TYPE_HEADER:
             dico_destroy(cur->headinfo.dico);
             break;
     }
     
-    q->head=cur->next;
-    free(cur);
-    q->itemcount--;
+    queuelocked_remove_head(q);
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    pthread_cond_broadcast(&q->cond);
     return FSAERR_SUCCESS;
 }
@@ -34,6 +34,9 @@ typedef struct s_headinfo cheadinfo;
 struct s_queueitem;
 typedef struct s_queueitem cqueueitem;
 
+struct s_queuejobs;
+typedef struct s_queuejobs cqueuejobs;
+
 struct s_queue;
 typedef struct s_queue cqueue;
 
@@ -42,11 +45,22 @@ struct s_blockinfo // used when (type==QITEM_TYPE_BLOCK)
     u32                  blkrealsize; // size of the data in the normal state (not compressed and not crypted)
     u64                  blkoffset; // offset of the block in the normal file
     u32                  blkarcsum; // checksum of the block as it it when it's in the archive (compressed and encrypted)
+    u16                  blkarcsumalgo; // CSUMALGO_xxx: algorithm used to calculate blkarcsum
     u32                  blkarsize; // size of the block as it is in the archive (compressed and encrypted)
     u16                  blkcompalgo; // algo used to compressed the block
     u32                  blkcompsize; // size of the block after compression and before encryption
     u16                  blkcryptalgo; // algo used to compressed the block
+    u64                  blkcryptnonce; // number of the block used as the nonce when it's encrypted with aes256-gcm
+    u8                   blkdatamd5[16]; // md5 of the data in the normal state (calculated by the compression threads)
+    bool                 blkhasdatamd5; // true if blkdatamd5 is set (blocks of archives written by older versions have no md5)
+    bool                 blkdatacorrupt; // true if the data do not match blkdatamd5 after the block has been uncompressed
+    bool                 blkzero; // true if all the bytes of the block are zero: it has no data in the archive
     u16                  blkfsid; // id of filesystem to which the block belongs
+    u64                  blkfileid; // id of the file the block belongs to (see comphint_new_file()) or 0 if unknown
+    u16                  blkcomppolicy; // COMPPOLICY_xxx: compression chosen from the type of the file (option -t)
+    bool                 blkshared; // true if the block contains several small files (see regmulti.c)
+    u64                  blkgroupid; // solid group of the block (option -g) or 0: a group is processed by one thread
+    u32                  blkgrouppos; // position of the block in the compressed stream of its group (0 when it starts)
     bool                 blklocked; // true if locked (being processed in the compress/crypt thread)
 };
 
@@ -60,20 +74,44 @@ struct s_queueitem
 {   int                  type; // QITEM_TYPE_BLOCK or QITEM_TYPE_HEADER
     int                  status; // compressed, being-compressed, not-yet-compressed
     s64                  itemnum; // unique identifier of the item in the queue
-    cqueueitem           *next; // next block in the linked list
+    s64                  claimnum; // equal to itemnum while the block waits for a compression thread, zero once claimed
+    u64                  memsize; // how many bytes this item is charged against the memory budget of the queue
     cblockinfo           blkinfo; // used when type==QITEM_TYPE_BLOCK (for blocks only)
     cheadinfo            headinfo; // used when type==QITEM_TYPE_HEADER (for headers only)
 };
 
+struct s_queuejobs // blocks waiting for a particular compression thread (other threads can steal them)
+{   pthread_mutex_t      mutex; // protects this list only so that threads do not contend on the queue mutex
+    s64                  *itemnums; // circular buffer of item numbers (blocks with QITEM_STATUS_TODO)
+    u64                  size; // how many item numbers the buffer can hold
+    u64                  first; // index of the oldest item number in the buffer
+    u64                  count; // how many item numbers there are in the buffer
+};
+
 struct s_queue
-{   cqueueitem           *head; // head of the queue: first item
+{   cqueueitem           *ring; // circular buffer: item number N is stored in ring[N & ringmask]
+    u64                  ringsize; // how many items the ring can hold (power of two)
+    u64                  ringmask; // ringsize-1: used to convert an item number into a ring index
+    s64                  headnum; // item number of the head of the queue (first item to be dequeued)
     pthread_mutex_t      mutex; // pthread mutex for data protection
-    pthread_cond_t       cond; // condition for pthread synchronization
-    s64                  curitemnum; // unique id given to every new item (block or header)
+    pthread_cond_t       condnotfull; // signaled when an item is removed (producers wait for free space)
+    pthread_cond_t       conddone; // signaled when the head of the queue may be ready to be dequeued
+    s64                  curitemnum; // unique id given to every new item (block or header): it's also the tail
     u64                  itemcount; // how many items there are (headers + blocks)
     u64                  blkcount; // how many blocks items there are (items where type==QITEM_TYPE_BLOCK only)
-    u64                  blkmax; // how many blocks items there can be before the queue is considered as full
+    u64                  memcount; // how many bytes the items in the queue are charged (see queue_block_memory())
+    u64                  memmax; // how many bytes the items can use before the queue is considered as full
     bool                 endofqueue; // set to true when no more data to put in queue (like eof): reader must stop
+    cqueuejobs           *jobs; // one list of blocks to process per compression thread
+    int                  jobscount; // how many compression threads there are
+    int                  nextjobs; // index of the list where the next block will be added
+    pthread_mutex_t      idlemutex; // protects the fields used by compression threads which have nothing to do
+    pthread_cond_t       condidle; // signaled when a block has been added and compression threads are idle
+    volatile int         idlecount; // how many compression threads are waiting on condidle
+    bool                 finished; // true when compression threads must exit (set with both mutexes locked)
+    u64                  compstalls; // how many times the writer waited for the head of the queue to be compressed
+    u64                  outputstalls; // how many times a producer waited because the queue was full of compressed items
+    u64                  idlestalls; // how many times a compression thread waited because there was nothing to do
 };
 
 // ----return status
@@ -82,8 +120,10 @@ struct s_queue
 // c) "<0" QERR error number
 
 // init and destroy
-s64  queue_init(cqueue *l, s64 blkmax);
+s64  queue_init(cqueue *l, u64 memmax);
 s64  queue_destroy(cqueue *l);
+s64  queue_set_workers(cqueue *q, int count);
+s64  queue_set_max_memory(cqueue *q, u64 memmax);
 
 // information functions
 s64  queue_count(cqueue *l);
@@ -91,6 +131,7 @@ s64  queue_count_status(struct s_queue *l, int status);
 s64  queue_is_first_item_ready(struct s_queue *q);
 s64  queue_check_next_item(cqueue *q, int *type, char *magic);
 s64  queue_count_items_todo(cqueue *q);
+s64  queue_get_stalls(cqueue *q, u64 *compstalls, u64 *outputstalls, u64 *idlestalls);
 
 // modification functions
 s64  queue_add_block(cqueue *q, cblockinfo *blkinfo, int status);
@@ -104,7 +145,7 @@ s64  queue_set_end_of_queue(cqueue *q, bool state);
 bool queue_get_end_of_queue(cqueue *q);
 
 // get item from queue functions
-s64  queue_get_first_block_todo(cqueue *q, cblockinfo *blkinfo);
+s64  queue_get_block_todo(cqueue *q, int worker, cblockinfo *blkinfo);
 s64  queue_dequeue_header(cqueue *q, struct s_dico **d, char *magicbuf, u16 *fsid);
 s64  queue_dequeue_header_internal(cqueue *q, cheadinfo *headinfo);
 s64  queue_dequeue_block(cqueue *q, cblockinfo *blkinfo);
@@ -0,0 +1,432 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "fsarchiver.h"
+#include "readpool.h"
+#include "blkpool.h"
+#include "common.h"
+#include "error.h"
+
+// The reader threads read the blocks of the current large file while the main thread queues the blocks which
+// have already been read, so that several requests are sent to the disk at the same time. The main thread
+// submits up to depth blocks in the order of the file and it gets them back in the same order, so the archive
+// does not depend on the threads. The threads also ask the kernel to read the beginning of the next large file
+// of the directory so that the main thread does not wait for the disk when it starts that file.
+// The small files of the current directory are opened and read by the threads in the same way: the main thread
+// submits the next small files of the directory (up to the next subdirectory) and it gets each of them back
+// with the descriptor opened by the thread when it saves that entry.
+
+static void readpool_read(creadjob *job)
+{
+    if (job->type==READJOB_TYPE_FILE)
+    {   if ((job->fd=openat(job->dirfd, job->name, O_RDONLY|O_LARGEFILE|O_NOFOLLOW))<0)
+        {   job->res=-1;
+            job->err=errno;
+            return;
+        }
+        job->res=read(job->fd, job->data, (long)job->size);
+    }
+    else
+    {   job->res=pread64(job->fd, job->data, (long)job->size, job->offset);
+    }
+    job->err=(job->res<0)?errno:0;
+}
+
+static int readring_init(creadring *r, u32 depth)
+{
+    r->depth=max(depth, 1);
+    if ((r->jobs=calloc(r->depth, sizeof(creadjob)))==NULL)
+    {   errprintf("calloc(%ld) failed: out of memory\n", (long)(r->depth*sizeof(creadjob)));
+        return -1;
+    }
+    return 0;
+}
+
+static bool readring_is_full(creadring *r)
+{
+    return ((r->tailnum-r->headnum) >= r->depth);
+}
+
+// the main thread fills the job and it makes it visible to the threads with readring_push()
+static creadjob *readring_tail(creadring *r)
+{
+    creadjob *job;
+    
+    job=&r->jobs[r->tailnum % r->depth];
+    memset(job, 0, sizeof(creadjob));
+    job->fd=-1;
+    job->dirfd=-1;
+    return job;
+}
+
+static bool readpool_has_todo(creadpool *p)
+{
+    return ((p->blocks.takenum < p->blocks.tailnum) || (p->files.takenum < p->files.tailnum));
+}
+
+// a thread is woken when there was nothing to take (unless wake is false because the caller submits a batch
+// of jobs) and it wakes another one if there are more jobs when it takes one
+static void readring_push(creadpool *p, creadring *r, creadjob *job, bool wake)
+{
+    pthread_mutex_lock(&p->mutex);
+    wake=(wake==true) && (readpool_has_todo(p)==false);
+    r->tailnum++;
+    if (job->status==READJOB_STATUS_DONE)
+        r->takenum=r->tailnum; // the job has already been done: the threads must not take it
+    else if (wake==true)
+        pthread_cond_signal(&p->condwork);
+    pthread_mutex_unlock(&p->mutex);
+}
+
+static void readring_wait(creadpool *p, creadring *r, creadjob *job)
+{
+    creadjob *head;
+    
+    head=&r->jobs[r->headnum % r->depth];
+    pthread_mutex_lock(&p->mutex);
+    if (head->status==READJOB_STATUS_TODO) // no thread has taken it yet: the main thread does not wait for one
+    {   assert(r->takenum==r->headnum);
+        r->takenum++;
+        head->status=READJOB_STATUS_PROGRESS;
+        pthread_mutex_unlock(&p->mutex);
+        readpool_read(head);
+        pthread_mutex_lock(&p->mutex);
+        head->status=READJOB_STATUS_DONE;
+    }
+    while (head->status!=READJOB_STATUS_DONE)
+        pthread_cond_wait(&p->conddone, &p->mutex);
+    pthread_mutex_unlock(&p->mutex);
+    
+    *job=*head;
+    r->headnum++;
+}
+
+// drop the jobs which have not been received: the threads must not start the jobs which are waiting
+static void readring_cancel(creadpool *p, creadring *r)
+{
+    creadjob *job;
+    
+    pthread_mutex_lock(&p->mutex);
+    r->takenum=r->tailnum;
+    for (; r->headnum < r->tailnum; r->headnum++)
+    {   job=&r->jobs[r->headnum % r->depth];
+        while (job->status==READJOB_STATUS_PROGRESS)
+            pthread_cond_wait(&p->conddone, &p->mutex);
+        if (job->type==READJOB_TYPE_FILE)
+            readpool_release_file(job);
+        else
+            blkpool_free(job->data);
+    }
+    pthread_mutex_unlock(&p->mutex);
+}
+
+static void *readpool_thread(void *args)
+{
+    creadpool *p=(creadpool *)args;
+    creadring *r;
+    creadjob *job;
+    u64 advlen;
+    int advfd;
+    
+    pthread_mutex_lock(&p->mutex);
+    while (true)
+    {
+        while ((p->stop==false) && (readpool_has_todo(p)==false) && (p->advfd<0))
+            pthread_cond_wait(&p->condwork, &p->mutex);
+        if (p->stop==true)
+            break;
+        
+        if (readpool_has_todo(p)==true)
+        {   r=(p->blocks.takenum < p->blocks.tailnum)?&p->blocks:&p->files; // the blocks of the current file go first
+            job=&r->jobs[r->takenum % r->depth];
+            r->takenum++;
+            job->status=READJOB_STATUS_PROGRESS;
+            if (readpool_has_todo(p)==true)
+                pthread_cond_signal(&p->condwork);
+            pthread_mutex_unlock(&p->mutex);
+            
+            readpool_read(job);
+            
+            pthread_mutex_lock(&p->mutex);
+            job->status=READJOB_STATUS_DONE;
+            pthread_cond_broadcast(&p->conddone);
+        }
+        else // nothing to read: the kernel can read the beginning of the next large file
+        {   advfd=p->advfd;
+            advlen=p->advlen;
+            p->advfd=-1;
+            pthread_mutex_unlock(&p->mutex);
+            
+            posix_fadvise(advfd, 0, advlen, POSIX_FADV_WILLNEED);
+            close(advfd);
+            
+            pthread_mutex_lock(&p->mutex);
+        }
+    }
+    pthread_mutex_unlock(&p->mutex);
+    
+    return NULL;
+}
+
+int readpool_init(creadpool *p, int threadcount, u32 blkdepth, u32 filedepth)
+{
+    int i;
+    
+    assert(p);
+    
+    memset(p, 0, sizeof(creadpool));
+    p->fd=-1;
+    p->advfd=-1;
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->condwork, NULL);
+    pthread_cond_init(&p->conddone, NULL);
+    
+    if ((readring_init(&p->blocks, blkdepth)!=0) || (readring_init(&p->files, filedepth)!=0))
+        return -1;
+    
+    if ((threadcount>0) && ((p->threads=malloc(threadcount*sizeof(pthread_t)))==NULL))
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)(threadcount*sizeof(pthread_t)));
+        threadcount=0;
+    }
+    
+    // the main thread reads the files itself if the threads cannot be created
+    for (i=0; i < threadcount; i++)
+    {   if (pthread_create(&p->threads[i], NULL, readpool_thread, (void*)p)!=0)
+        {   errprintf("pthread_create(readpool_thread) failed\n");
+            break;
+        }
+        p->threadcount++;
+    }
+    
+    return 0;
+}
+
+int readpool_destroy(creadpool *p)
+{
+    int i;
+    
+    assert(p);
+    
+    readpool_cancel(p);
+    readpool_cancel_files(p);
+    
+    pthread_mutex_lock(&p->mutex);
+    p->stop=true;
+    pthread_cond_broadcast(&p->condwork);
+    pthread_mutex_unlock(&p->mutex);
+    
+    for (i=0; i < p->threadcount; i++)
+        pthread_join(p->threads[i], NULL);
+    
+    if (p->advfd>=0)
+        close(p->advfd);
+    
+    pthread_cond_destroy(&p->condwork);
+    pthread_cond_destroy(&p->conddone);
+    pthread_mutex_destroy(&p->mutex);
+    free(p->threads);
+    free(p->blocks.jobs);
+    free(p->files.jobs);
+    return 0;
+}
+
+// the jobs of the previous file must have been received with readpool_wait() or dropped with readpool_cancel()
+int readpool_start_file(creadpool *p, int fd, bool parallel)
+{
+    assert(p);
+    assert(p->blocks.headnum==p->blocks.tailnum);
+    
+    // the kernel reads bigger chunks in advance when it knows that the file is read sequentially
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    
+    p->fd=fd;
+    p->direct=((p->threadcount==0) || (parallel==false));
+    return 0;
+}
+
+bool readpool_is_full(creadpool *p)
+{
+    assert(p);
+    
+    return readring_is_full(&p->blocks);
+}
+
+// the pool owns data until the job is received by readpool_wait()
+int readpool_submit(creadpool *p, char *data, u64 offset, u32 size)
+{
+    creadjob *job;
+    
+    assert(p);
+    assert(readring_is_full(&p->blocks)==false);
+    
+    job=readring_tail(&p->blocks);
+    job->type=READJOB_TYPE_BLOCK;
+    job->data=data;
+    job->offset=offset;
+    job->size=size;
+    job->fd=p->fd;
+    
+    if (p->direct==true)
+    {   readpool_read(job);
+        job->status=READJOB_STATUS_DONE;
+    }
+    else
+    {   job->status=READJOB_STATUS_TODO;
+    }
+    
+    readring_push(p, &p->blocks, job, true);
+    return 0;
+}
+
+// get the oldest block which has been submitted once it has been read
+int readpool_wait(creadpool *p, creadjob *job)
+{
+    assert(p);
+    assert(job);
+    
+    if (p->blocks.headnum==p->blocks.tailnum)
+    {   errprintf("there is no block to wait for\n");
+        return -1;
+    }
+    
+    readring_wait(p, &p->blocks, job);
+    return 0;
+}
+
+// drop the blocks which have not been received (when the file is not saved until the end)
+int readpool_cancel(creadpool *p)
+{
+    assert(p);
+    
+    readring_cancel(p, &p->blocks);
+    p->fd=-1;
+    return 0;
+}
+
+// the pool owns fd: it's closed by a thread once the kernel has been asked to read the first bytes of the file
+int readpool_prefetch(creadpool *p, int fd, u64 length)
+{
+    assert(p);
+    
+    pthread_mutex_lock(&p->mutex);
+    if ((p->threadcount==0) || (p->advfd>=0)) // there is no thread or the previous file is still waiting
+    {   pthread_mutex_unlock(&p->mutex);
+        close(fd);
+        return 0;
+    }
+    p->advfd=fd;
+    p->advlen=length;
+    pthread_cond_signal(&p->condwork);
+    pthread_mutex_unlock(&p->mutex);
+    return 0;
+}
+
+// false when the main thread has to read the small files itself (no thread or too many files in flight)
+bool readpool_can_submit_file(creadpool *p)
+{
+    assert(p);
+    
+    return ((p->threadcount>0) && (readring_is_full(&p->files)==false));
+}
+
+// how many small files have been submitted and not yet received
+u32 readpool_count_files(creadpool *p)
+{
+    assert(p);
+    
+    return (u32)(p->files.tailnum-p->files.headnum);
+}
+
+// dirfd must stay open until the job has been received with readpool_get_file() or dropped, and the threads
+// only start to read the files submitted when readpool_wake() is called
+int readpool_submit_file(creadpool *p, int dirfd, char *name, char *data, u32 size)
+{
+    creadjob *job;
+    
+    assert(p);
+    assert(readpool_can_submit_file(p)==true);
+    
+    job=readring_tail(&p->files);
+    job->type=READJOB_TYPE_FILE;
+    job->data=data;
+    job->size=size;
+    job->dirfd=dirfd;
+    job->name=name;
+    job->status=READJOB_STATUS_TODO;
+    
+    readring_push(p, &p->files, job, false);
+    return 0;
+}
+
+// the threads are woken once the small files have been submitted: they would read them one at a time otherwise
+int readpool_wake(creadpool *p)
+{
+    assert(p);
+    
+    pthread_mutex_lock(&p->mutex);
+    if (readpool_has_todo(p)==true)
+        pthread_cond_signal(&p->condwork);
+    pthread_mutex_unlock(&p->mutex);
+    return 0;
+}
+
+// get the small file called name if it's the next one which has been submitted: the caller owns the descriptor
+// and the data of the job and it must give them back with readpool_release_file()
+int readpool_get_file(creadpool *p, char *name, creadjob *job)
+{
+    assert(p);
+    assert(job);
+    
+    if ((p->files.headnum==p->files.tailnum) || (p->files.jobs[p->files.headnum % p->files.depth].name!=name))
+        return -1; // that file has not been submitted: the caller has to read it
+    
+    readring_wait(p, &p->files, job);
+    return 0;
+}
+
+int readpool_release_file(creadjob *job)
+{
+    assert(job);
+    
+    if (job->fd>=0)
+        close(job->fd);
+    blkpool_free(job->data);
+    job->fd=-1;
+    job->data=NULL;
+    return 0;
+}
+
+// drop the small files which have not been received: it must be called before their directory is closed
+int readpool_cancel_files(creadpool *p)
+{
+    assert(p);
+    
+    readring_cancel(p, &p->files);
+    return 0;
+}
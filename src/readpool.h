@@ -0,0 +1,89 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __READPOOL_H__
+#define __READPOOL_H__
+
+#include <pthread.h>
+
+#include "types.h"
+
+enum {READJOB_STATUS_TODO=0, READJOB_STATUS_PROGRESS, READJOB_STATUS_DONE};
+enum {READJOB_TYPE_BLOCK=0, READJOB_TYPE_FILE};
+
+struct s_readjob;
+typedef struct s_readjob creadjob;
+
+struct s_readring;
+typedef struct s_readring creadring;
+
+struct s_readpool;
+typedef struct s_readpool creadpool;
+
+struct s_readjob // a block of the current large file or a small file which is read by the reader threads
+{   int                  type; // READJOB_TYPE_BLOCK or READJOB_TYPE_FILE
+    char                 *data; // buffer allocated by the main thread where the data are read
+    u64                  offset; // offset of the block in the file (zero for small files)
+    u32                  size; // how many bytes have to be read
+    int                  fd; // descriptor to read from: the large file, or the small file opened by the thread or -1
+    int                  dirfd; // READJOB_TYPE_FILE: descriptor of the directory where the small file is
+    char                 *name; // READJOB_TYPE_FILE: name of the small file in dirfd (entry of the walker)
+    s64                  res; // result of the read: number of bytes read or -1
+    int                  err; // errno set by openat() or by the read when it failed
+    int                  status; // READJOB_STATUS_xxx: read, being read, not yet read
+};
+
+struct s_readring // jobs which are received by the main thread in the order it submitted them
+{   creadjob             *jobs; // circular buffer: job number N is stored in jobs[N % depth]
+    u32                  depth; // how many jobs can be in flight
+    u64                  headnum; // number of the oldest job (the next one the main thread will get)
+    u64                  takenum; // number of the next job a reader thread will take
+    u64                  tailnum; // number of the next job the main thread will submit
+};
+
+struct s_readpool // pool of threads which read the large and the small files before the main thread needs them
+{   pthread_t            *threads; // the reader threads
+    int                  threadcount; // how many reader threads have been created
+    pthread_mutex_t      mutex; // protects all the fields below
+    pthread_cond_t       condwork; // signaled when there is something to read or when threads must exit
+    pthread_cond_t       conddone; // signaled when a job has been done
+    creadring            blocks; // blocks of the current large file
+    creadring            files; // next small files of the current directory
+    int                  fd; // descriptor of the current large file (opened and closed by the caller)
+    bool                 direct; // true when the blocks are read by the main thread (no thread or only one block)
+    int                  advfd; // descriptor of the next large file to prefetch or -1 (closed by the threads)
+    u64                  advlen; // how many bytes of the next large file to prefetch
+    bool                 stop; // true when the threads must exit
+};
+
+int  readpool_init(creadpool *p, int threadcount, u32 blkdepth, u32 filedepth);
+int  readpool_destroy(creadpool *p);
+int  readpool_start_file(creadpool *p, int fd, bool parallel);
+bool readpool_is_full(creadpool *p);
+int  readpool_submit(creadpool *p, char *data, u64 offset, u32 size);
+int  readpool_wait(creadpool *p, creadjob *job);
+int  readpool_cancel(creadpool *p);
+int  readpool_prefetch(creadpool *p, int fd, u64 length);
+bool readpool_can_submit_file(creadpool *p);
+u32  readpool_count_files(creadpool *p);
+int  readpool_submit_file(creadpool *p, int dirfd, char *name, char *data, u32 size);
+int  readpool_wake(creadpool *p);
+int  readpool_get_file(creadpool *p, char *name, creadjob *job);
+int  readpool_release_file(creadjob *job);
+int  readpool_cancel_files(creadpool *p);
+
+#endif // __READPOOL_H__
@@ -28,6 +28,7 @@
 #include "regmulti.h"
 #include "common.h"
 #include "queue.h"
+#include "blkpool.h"
 #include "error.h"
 
 int regmulti_empty(cregmulti *m)
@@ -109,7 +110,7 @@ int regmulti_save_addfile(cregmulti *m, cdico *header, char *data, u32 datsize)
 }
 
 // add headers and datblock at the end of the queue
-int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid)
+int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid, u64 groupid)
 {
     cblockinfo blkinfo;
     char *dynblock;
@@ -159,8 +160,8 @@ int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid)
     }
     
     // make a copy of the static block to dynamic memory
-    if ((dynblock=malloc(m->usedsize)) == NULL)
-    {   errprintf("malloc(%ld) failed: out of memory\n", (long)m->usedsize);
+    if ((dynblock=blkpool_alloc(m->usedsize)) == NULL)
+    {   errprintf("blkpool_alloc(%ld) failed: out of memory\n", (long)m->usedsize);
         return -1;
     }
     memcpy(dynblock, m->data, m->usedsize);
@@ -170,6 +171,8 @@ int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid)
     blkinfo.blkdata=(char*)dynblock;
     blkinfo.blkoffset=0; // no meaning for multi-regfiles
     blkinfo.blkfsid=fsid;
+    blkinfo.blkshared=true; // can be compressed with the dictionary of the archive
+    blkinfo.blkgroupid=groupid;
     if (queue_add_block(q, &blkinfo, QITEM_STATUS_TODO)!=0)
     {   errprintf("queue_add_block() failed\n");
         return -1;
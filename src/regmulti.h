@@ -44,7 +44,7 @@ int  regmulti_init(cregmulti *m, u32 maxblksize);
 int  regmulti_count(cregmulti *m, struct s_dico *header, char *data, u32 datsize);
 bool regmulti_save_enough_space_for_new_file(cregmulti *m, u32 filesize);
 int  regmulti_save_addfile(cregmulti *m, struct s_dico *header, char *data, u32 datsize);
-int  regmulti_save_enqueue(cregmulti *m, struct s_queue *q, int fsid);
+int  regmulti_save_enqueue(cregmulti *m, struct s_queue *q, int fsid, u64 groupid);
 int  regmulti_rest_addheader(cregmulti *m, struct s_dico *header);
 int  regmulti_rest_setdatablock(cregmulti *m, char *data, u32 datsize);
 int  regmulti_rest_getfile(cregmulti *m, int index, struct s_dico **filehead, char *data, u64 *datsize, u32 bufsize);
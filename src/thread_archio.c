@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <gcrypt.h>
 
 #include "fsarchiver.h"
 #include "archreader.h"
@@ -31,12 +32,15 @@
 #include "error.h"
 #include "syncthread.h"
 #include "queue.h"
+#include "blkpool.h"
+#include "compdict.h"
 
 void *thread_writer_fct(void *args)
 {
     struct s_headinfo headinfo;
     struct s_blockinfo blkinfo;
     carchwriter *ai=NULL;
+    gcry_md_hd_t filemd5=NULL;
     s64 blknum;
     int type;
     
@@ -47,6 +51,10 @@ void *thread_writer_fct(void *args)
     {   errprintf("ai is NULL\n");
         goto thread_writer_fct_error;
     }
+    if (gcry_md_open(&filemd5, GCRY_MD_MD5, 0)!=GPG_ERR_NO_ERROR)
+    {   errprintf("gcry_md_open() failed\n");
+        goto thread_writer_fct_error;
+    }
     if (archwriter_volpath(ai)!=0)
     {   msgprintf(MSG_STACK, "archwriter_volpath() failed\n");
         goto thread_writer_fct_error;
@@ -71,13 +79,20 @@ void *thread_writer_fct(void *args)
             switch (type)
             {
                 case QITEM_TYPE_BLOCK:
+                    // the items are written in order: the md5 of the blocks of a large file are combined here
+                    if ((blkinfo.blkshared==false) && (blkinfo.blkhasdatamd5==true))
+                        gcry_md_write(filemd5, blkinfo.blkdatamd5, 16);
                     if (archwriter_dowrite_block(ai, &blkinfo)!=0)
                     {   msgprintf(MSG_STACK, "archive_dowrite_block() failed\n");
                         goto thread_writer_fct_error;
                     }
-                    free(blkinfo.blkdata);
+                    blkpool_free(blkinfo.blkdata);
                     break;
                 case QITEM_TYPE_HEADER:
+                    if (memcmp(headinfo.magic, FSA_MAGIC_FILF, FSA_SIZEOF_MAGIC)==0)
+                        dico_add_data(headinfo.dico, 0, BLOCKFOOTITEMKEY_DATAMD5, gcry_md_read(filemd5, GCRY_MD_MD5), 16);
+                    if ((memcmp(headinfo.magic, FSA_MAGIC_FILF, FSA_SIZEOF_MAGIC)==0) || (memcmp(headinfo.magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC)==0))
+                        gcry_md_reset(filemd5);
                     if (archwriter_dowrite_header(ai, &headinfo)!=0)
                     {   msgprintf(MSG_STACK, "archive_write_header() failed\n");
                         goto thread_writer_fct_error;
@@ -97,6 +112,7 @@ void *thread_writer_fct(void *args)
         goto thread_writer_fct_error;
     }
     archwriter_close(ai);
+    gcry_md_close(filemd5);
     msgprintf(MSG_DEBUG1, "THREAD-WRITER: exit success\n");
     dec_secthreads();
     return NULL;
@@ -107,6 +123,8 @@ thread_writer_fct_error:
     while (queue_get_end_of_queue(&g_queue)==false) // wait until all the compression threads exit
         queue_destroy_first_item(&g_queue); // empty queue
     archwriter_close(ai);
+    if (filemd5!=NULL)
+        gcry_md_close(filemd5);
     dec_secthreads();
     return NULL;
 }
@@ -237,7 +255,7 @@ void *thread_reader_fct(void *args)
                 
                 if (skipblock==false)
                 {
-                    status=((sumok==true)?QITEM_STATUS_TODO:QITEM_STATUS_DONE);
+                    status=((sumok==true) && (blkinfo.blkzero==false))?QITEM_STATUS_TODO:QITEM_STATUS_DONE;
                     if ((lres=queue_add_block(&g_queue, &blkinfo, status))!=FSAERR_SUCCESS)
                     {   if (lres!=FSAERR_NOTOPEN)
                             errprintf("queue_add_block()=%ld=%s failed\n", (long)lres, error_int_to_string(lres));
@@ -247,6 +265,14 @@ void *thread_reader_fct(void *args)
                     dico_destroy(dico);
                 }
             }
+            else if (strncmp(magic, FSA_MAGIC_DICT, FSA_SIZEOF_MAGIC)==0) // dictionary for the blocks which follow
+            {
+                if (compdict_read_header(dico)!=0)
+                {   errprintf("cannot read the dictionary of the archive\n");
+                    errors++;
+                }
+                dico_destroy(dico);
+            }
             else // another higher level header
             {
                 // if it's a global header or a if this local header belongs to a filesystem that the main thread needs
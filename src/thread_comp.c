@@ -27,36 +27,228 @@
 
 #include "fsarchiver.h"
 #include "common.h"
+#include "checksum.h"
 #include "options.h"
 #include "comp_gzip.h"
 #include "comp_bzip2.h"
 #include "comp_lzma.h"
 #include "comp_lzo.h"
+#include "comp_zstd.h"
+#include "comp_lz4.h"
 #include "crypto.h"
 #include "syncthread.h"
 #include "thread_comp.h"
 #include "error.h"
 #include "queue.h"
+#include "blkpool.h"
+#include "autolevel.h"
+#include "comppolicy.h"
+#include "compdict.h"
 
-int compress_block_generic(struct s_blockinfo *blkinfo)
+// compressibility of the files being saved: each slot is (fileid<<16)|streak where streak is the number of
+// consecutive incompressible blocks of the file. A slot can be taken by another file: it's only a hint.
+static u64 g_comphint[FSA_COMPHINT_SLOTS];
+static u64 g_comphintfileid=0;
+
+u64 comphint_new_file()
+{
+    return __sync_add_and_fetch(&g_comphintfileid, 1);
+}
+
+static u32 comphint_get_streak(u64 fileid)
+{
+    u64 slot;
+    
+    if (fileid==0)
+        return 0;
+    slot=__sync_fetch_and_add(&g_comphint[fileid % FSA_COMPHINT_SLOTS], 0);
+    return ((slot>>16)==fileid)?(u32)(slot&0xFFFF):0;
+}
+
+static void comphint_set_streak(u64 fileid, u32 streak)
+{
+    if (fileid==0)
+        return;
+    (void)__sync_lock_test_and_set(&g_comphint[fileid % FSA_COMPHINT_SLOTS], (fileid<<16)|(streak&0xFFFF));
+}
+
+// identifiers of the solid groups (option -g): the blocks of a group are given to the same compression thread
+static u64 g_solidgroupid=0;
+
+u64 solidgroup_new()
+{
+    return __sync_add_and_fetch(&g_solidgroupid, 1);
+}
+
+// log2(x) in 1/16 bits for x>0: rounded to the nearest so that the entropy estimate is not biased
+static u32 log2_bits16(u32 x)
+{
+    u32 intpart=31-__builtin_clz(x);
+    u64 mant=((u64)x<<16)>>intpart; // x/2^intpart in [1,2) with 16 fractional bits
+    u32 res=intpart<<8;
+    int i;
+    
+    for (i=7; i>=0; i--) // 8 fractional bits which are rounded to 4 at the end
+    {   mant=(mant*mant)>>16;
+        if (mant>=(2<<16))
+        {   res|=(1<<i);
+            mant>>=1;
+        }
+    }
+    return (res+(1<<3))>>4;
+}
+
+// estimate the entropy of a block from a sample of its bytes: data which is already compressed or
+// encrypted is close to 8 bits per byte and it's a waste of time to pass it to the compression algorithm
+static bool block_looks_incompressible(u8 *data, u32 size)
+{
+    u32 histogram[256];
+    u32 sample, step;
+    u32 logsample;
+    u64 bits16=0;
+    int i, j;
+    
+    if (size<FSA_ENTROPY_MINSIZE)
+        return false;
+    
+    memset(histogram, 0, sizeof(histogram));
+    step=(size-FSA_ENTROPY_CHUNKSIZE)/(FSA_ENTROPY_CHUNKS-1);
+    for (i=0; i<FSA_ENTROPY_CHUNKS; i++)
+        for (j=0; j<FSA_ENTROPY_CHUNKSIZE; j++)
+            histogram[data[i*step+j]]++;
+    
+    // entropy = sum(count*log2(sample/count))/sample
+    sample=FSA_ENTROPY_CHUNKS*FSA_ENTROPY_CHUNKSIZE;
+    logsample=log2_bits16(sample);
+    for (i=0; i<256; i++)
+        if (histogram[i]>0)
+            bits16+=(u64)histogram[i]*(logsample-log2_bits16(histogram[i]));
+    
+    return (bits16 >= (u64)FSA_ENTROPY_MAXBITS16*sample);
+}
+
+// the fields of the block header which are required to restore the block are authenticated with its data
+static int block_crypt_aad(struct s_blockinfo *blkinfo, u8 *aad)
+{
+    u64 offset=cpu_to_le64(blkinfo->blkoffset);
+    u32 realsize=cpu_to_le32(blkinfo->blkrealsize);
+    u16 compalgo=cpu_to_le16(blkinfo->blkcompalgo);
+    
+    memcpy(aad, &offset, sizeof(offset));
+    memcpy(aad+8, &realsize, sizeof(realsize));
+    memcpy(aad+12, &compalgo, sizeof(compalgo));
+    return 14;
+}
+
+int compctx_init(ccompctx *ctx)
+{
+    ctx->solidgroup=0;
+    ctx->solidpos=0;
+    ctx->solidalgo=COMPRESS_NULL;
+    ctx->solidlevel=0;
+    crypto_ctx_init(&ctx->crypt);
+    comp_gzip_ctx_init(&ctx->gzip);
+#ifdef OPTION_LZMA_SUPPORT
+    comp_lzma_ctx_init(&ctx->lzma);
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_LZO_SUPPORT
+    comp_lzo_ctx_init(&ctx->lzo);
+#endif // OPTION_LZO_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+    comp_zstd_ctx_init(&ctx->zstd);
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+    comp_lz4_ctx_init(&ctx->lz4);
+#endif // OPTION_LZ4_SUPPORT
+    return 0;
+}
+
+int compctx_destroy(ccompctx *ctx)
+{
+    crypto_ctx_destroy(&ctx->crypt);
+    comp_gzip_ctx_destroy(&ctx->gzip);
+#ifdef OPTION_LZMA_SUPPORT
+    comp_lzma_ctx_destroy(&ctx->lzma);
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_LZO_SUPPORT
+    comp_lzo_ctx_destroy(&ctx->lzo);
+#endif // OPTION_LZO_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+    comp_zstd_ctx_destroy(&ctx->zstd);
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+    comp_lz4_ctx_destroy(&ctx->lz4);
+#endif // OPTION_LZ4_SUPPORT
+    return 0;
+}
+
+int compress_block_generic(struct s_blockinfo *blkinfo, ccompctx *ctx)
 {
     char *bufcomp=NULL;
+    char *bufcrypt=NULL;
     int attempt=0;
     int compalgo;
     int complevel;
+    u64 cryptsize;
     u64 compsize;
     u64 bufsize;
+    bool newstream=false;
+    bool solid=false;
+    u8 aad[16];
+    int aadlen;
+    u32 dictsize;
+    u8 *dict;
+    u32 streak;
     int res;
     
     bufsize = (blkinfo->blkrealsize) + (blkinfo->blkrealsize / 16) + 64 + 3; // alloc bigger buffer else lzo will crash
-    if ((bufcomp=malloc(bufsize))==NULL)
-    {   errprintf("malloc(%ld) failed: out of memory\n", (long)bufsize);
+    
+    // md5 of the data as they are in the file: the writer thread combines them in the footer of the file
+    gcry_md_hash_buffer(GCRY_MD_MD5, blkinfo->blkdatamd5, blkinfo->blkdata, blkinfo->blkrealsize);
+    blkinfo->blkhasdatamd5=true;
+    
+    // don't compress blocks of files which have been incompressible so far, but check again from time to time
+    streak=comphint_get_streak(blkinfo->blkfileid);
+    if ((blkinfo->blkcomppolicy==COMPPOLICY_STORE)
+        || ((streak>=FSA_COMPHINT_STREAK) && (streak%FSA_COMPHINT_RECHECK!=0))
+        || block_looks_incompressible((u8*)blkinfo->blkdata, blkinfo->blkrealsize))
+    {   comphint_set_streak(blkinfo->blkfileid, streak+1);
+        blkinfo->blkcompsize=blkinfo->blkrealsize;
+        blkinfo->blkarsize=blkinfo->blkrealsize;
+        blkinfo->blkcompalgo=COMPRESS_NONE;
+        goto compress_block_generic_encrypt;
+    }
+    
+    if ((bufcomp=blkpool_alloc(bufsize))==NULL)
+    {   errprintf("blkpool_alloc(%ld) failed: out of memory\n", (long)bufsize);
         return -1;
     }
     
     // compression level/algo to use for the first attempt
     compalgo=g_options.compressalgo;
     complevel=g_options.compresslevel;
+    if (g_options.compressauto==true)
+    {   autolevel_get(&compalgo, &complevel);
+        autolevel_update();
+    }
+    dict=(blkinfo->blkshared==true)?compdict_get(&dictsize):NULL;
+    if (blkinfo->blkcomppolicy==COMPPOLICY_FAST)
+        autolevel_get_fastest(&compalgo, &complevel);
+    else if (blkinfo->blkcomppolicy==COMPPOLICY_STRONG)
+        autolevel_get_strongest(&compalgo, &complevel);
+    
+    // the blocks of a solid group continue the stream of the previous block when the codec is the same
+    if ((blkinfo->blkgroupid!=0) && ((compalgo==COMPRESS_LZMA) || (compalgo==COMPRESS_ZSTD)))
+    {   solid=true;
+        dict=NULL; // the previous blocks are better than a dictionary
+        newstream=((ctx->solidgroup!=blkinfo->blkgroupid) || (ctx->solidalgo!=((compalgo==COMPRESS_LZMA)?COMPRESS_LZMASOLID:COMPRESS_ZSTDSOLID)) || (ctx->solidlevel!=complevel));
+        if (newstream==true)
+        {   ctx->solidgroup=blkinfo->blkgroupid;
+            ctx->solidpos=0;
+            ctx->solidalgo=(compalgo==COMPRESS_LZMA)?COMPRESS_LZMASOLID:COMPRESS_ZSTDSOLID;
+            ctx->solidlevel=complevel;
+        }
+    }
     
     // compress the block
     do
@@ -65,13 +257,13 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
         {
 #ifdef OPTION_LZO_SUPPORT
             case COMPRESS_LZO:
-                res=compress_block_lzo(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                res=compress_block_lzo(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel, &ctx->lzo);
                 blkinfo->blkcompalgo=COMPRESS_LZO;
                 break;
 #endif // OPTION_LZO_SUPPORT
             case COMPRESS_GZIP:
-                res=compress_block_gzip(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
-                blkinfo->blkcompalgo=COMPRESS_GZIP;
+                res=compress_block_gzip(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel, dict, dictsize, &ctx->gzip);
+                blkinfo->blkcompalgo=(dict!=NULL)?COMPRESS_GZIPDICT:COMPRESS_GZIP;
                 break;
             case COMPRESS_BZIP2:
                 res=compress_block_bzip2(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
@@ -79,12 +271,34 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
                 break;
 #ifdef OPTION_LZMA_SUPPORT
             case COMPRESS_LZMA:
-                res=compress_block_lzma(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                if (solid==true)
+                {   res=compress_block_lzma_solid(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel, newstream, &ctx->lzma);
+                    blkinfo->blkcompalgo=COMPRESS_LZMASOLID;
+                    break;
+                }
+                res=compress_block_lzma(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel, &ctx->lzma);
                 blkinfo->blkcompalgo=COMPRESS_LZMA;
                 break;
 #endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+            case COMPRESS_ZSTD:
+                if (solid==true)
+                {   res=compress_block_zstd_solid(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel, newstream, &ctx->zstd);
+                    blkinfo->blkcompalgo=COMPRESS_ZSTDSOLID;
+                    break;
+                }
+                res=compress_block_zstd(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel, dict, dictsize, &ctx->zstd);
+                blkinfo->blkcompalgo=(dict!=NULL)?COMPRESS_ZSTDDICT:COMPRESS_ZSTD;
+                break;
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+            case COMPRESS_LZ4:
+                res=compress_block_lz4(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel, &ctx->lz4);
+                blkinfo->blkcompalgo=COMPRESS_LZ4;
+                break;
+#endif // OPTION_LZ4_SUPPORT
             default:
-                free(bufcomp);
+                blkpool_free(bufcomp);
                 msgprintf(2, "invalid compression level: %d\n", (int)compalgo);
                 return -1;
         }
@@ -95,45 +309,57 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
             errprintf("attempt to compress the current block using an alternative algorithm (\"-z%d\")\n", FSA_DEF_COMPRESS_ALGO);
             compalgo = FSA_DEF_COMPRESS_ALGO;
             complevel = FSA_DEF_COMPRESS_LEVEL;
+            solid = false;
+            ctx->solidgroup = 0; // the stream has been lost
         }
         
     } while ((res == FSAERR_ENOMEM) && (attempt++ == 0));
     
-    // check compression status and efficiency
-    if ((res==FSAERR_SUCCESS) && (compsize < blkinfo->blkrealsize)) // compression worked and saved space
-    {   free(blkinfo->blkdata); // free old buffer (with uncompressed data)
+    // the stream of a solid group has to be started again when a block could not be added to it
+    if (solid==true)
+    {   if (res==FSAERR_SUCCESS)
+            blkinfo->blkgrouppos=ctx->solidpos++;
+        else
+            ctx->solidgroup=0;
+    }
+    
+    // check compression status and efficiency (a block which is part of a stream has to be kept as it is)
+    if ((res==FSAERR_SUCCESS) && ((compsize < blkinfo->blkrealsize) || (solid==true))) // compression worked and saved space
+    {   blkpool_free(blkinfo->blkdata); // free old buffer (with uncompressed data)
         blkinfo->blkdata=bufcomp; // new buffer (with compressed data)
         blkinfo->blkcompsize=compsize; // size after compression and before encryption
         blkinfo->blkarsize=compsize; // in case there is no encryption to set this
+        comphint_set_streak(blkinfo->blkfileid, 0);
         //errprintf ("COMP_DBG: block successfully compressed using %s\n", compress_algo_int_to_string(compalgo));
     }
     else // compressed version is bigger or compression failed: keep the original block
-    {   memcpy(bufcomp, blkinfo->blkdata, blkinfo->blkrealsize);
-        free(blkinfo->blkdata); // free old buffer
-        blkinfo->blkdata=bufcomp; // new buffer
+    {   blkpool_free(bufcomp); // the block keeps its original buffer: no need to copy the data
         blkinfo->blkcompsize=blkinfo->blkrealsize; // size after compression and before encryption
         blkinfo->blkarsize=blkinfo->blkrealsize;  // in case there is no encryption to set this
         blkinfo->blkcompalgo=COMPRESS_NONE;
+        comphint_set_streak(blkinfo->blkfileid, streak+1);
         //errprintf ("COMP_DBG: block copied uncompressed, attempted using %s\n", compress_algo_int_to_string(compalgo));
     }
     
-    u64 cryptsize;
-    char *bufcrypt=NULL;
-    if (g_options.encryptalgo==ENCRYPT_BLOWFISH)
+compress_block_generic_encrypt:
+    if (g_options.encryptalgo==ENCRYPT_AES256GCM)
     {
-        if ((bufcrypt=malloc(bufsize+8))==NULL)
-        {   errprintf("malloc(%ld) failed: out of memory\n", (long)bufsize+8);
+        if ((bufcrypt=blkpool_alloc(bufsize+FSA_CRYPT_TAGSIZE))==NULL)
+        {   errprintf("blkpool_alloc(%ld) failed: out of memory\n", (long)bufsize+FSA_CRYPT_TAGSIZE);
             return -1;
         }
-        if ((res=crypto_blowfish(blkinfo->blkcompsize, &cryptsize, (u8*)bufcomp, (u8*)bufcrypt, 
-            g_options.encryptpass, strlen((char*)g_options.encryptpass), 1))!=0)
-        {   errprintf("crypt_block_blowfish() failed\n");
+        blkinfo->blkcryptnonce=crypto_new_nonce();
+        aadlen=block_crypt_aad(blkinfo, aad);
+        if ((res=crypto_aes256gcm(blkinfo->blkcompsize, &cryptsize, (u8*)blkinfo->blkdata, (u8*)bufcrypt, 
+            blkinfo->blkcryptnonce, aad, aadlen, 1, &ctx->crypt))!=0)
+        {   errprintf("crypto_aes256gcm() failed\n");
+            blkpool_free(bufcrypt);
             return -1;
         }
-        free(bufcomp);
+        blkpool_free(blkinfo->blkdata);
         blkinfo->blkdata=bufcrypt;
         blkinfo->blkarsize=cryptsize;
-        blkinfo->blkcryptalgo=ENCRYPT_BLOWFISH;
+        blkinfo->blkcryptalgo=ENCRYPT_AES256GCM;
     }
     else
     {
@@ -141,31 +367,61 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
     }
     
     // calculates the final block checksum (block as it will be stored in the archive)
-    blkinfo->blkarcsum=fletcher32((void*)blkinfo->blkdata, blkinfo->blkarsize);
+    blkinfo->blkarcsumalgo=g_options.csumalgo;
+    blkinfo->blkarcsum=checksum_block(blkinfo->blkarcsumalgo, (void*)blkinfo->blkdata, blkinfo->blkarsize);
     
     return 0;
 }
 
-int decompress_block_generic(struct s_blockinfo *blkinfo)
+// the blocks of a solid group are uncompressed in the order of the stream by the thread which owns the group:
+// newstream is set to true when the block starts a new stream, and it fails when the previous block is missing
+static int solidgroup_check_stream(struct s_blockinfo *blkinfo, ccompctx *ctx, bool *newstream)
+{
+    if (blkinfo->blkgrouppos==0)
+    {   ctx->solidgroup=blkinfo->blkgroupid;
+        ctx->solidpos=0;
+        ctx->solidalgo=blkinfo->blkcompalgo;
+        *newstream=true;
+        return 0;
+    }
+    
+    if ((ctx->solidgroup!=blkinfo->blkgroupid) || (ctx->solidalgo!=blkinfo->blkcompalgo) || (ctx->solidpos!=blkinfo->blkgrouppos))
+    {   errprintf("block %ld of solid group %lld cannot be uncompressed: the previous block is missing\n", 
+            (long)blkinfo->blkgrouppos, (long long)blkinfo->blkgroupid);
+        return -1;
+    }
+    
+    *newstream=false;
+    return 0;
+}
+
+int decompress_block_generic(struct s_blockinfo *blkinfo, ccompctx *ctx)
 {
     u64 checkorigsize;
     char *bufcomp=NULL;
+    bool newstream;
+    u8 md5sum[16];
+    u8 aad[16];
+    int aadlen;
+    u32 dictsize;
+    u8 *dict;
     int res;
     
     // allocate memory for uncompressed data
-    if ((bufcomp=malloc(blkinfo->blkrealsize))==NULL)
-    {   errprintf("malloc(%ld) failed: cannot allocate memory for compressed block\n", (long)blkinfo->blkrealsize);
+    if ((bufcomp=blkpool_alloc(blkinfo->blkrealsize))==NULL)
+    {   errprintf("blkpool_alloc(%ld) failed: cannot allocate memory for compressed block\n", (long)blkinfo->blkrealsize);
         return -1;
     }
     
     // check the block checksum
-    if (fletcher32((u8*)blkinfo->blkdata, blkinfo->blkarsize)!=(blkinfo->blkarcsum))
+    if (checksum_block(blkinfo->blkarcsumalgo, (u8*)blkinfo->blkdata, blkinfo->blkarsize)!=(blkinfo->blkarcsum))
     {   errprintf("block is corrupt at blockoffset=%ld, blksize=%ld\n", (long)blkinfo->blkoffset, (long)blkinfo->blkrealsize);
         memset(bufcomp, 0, blkinfo->blkrealsize);
+        blkinfo->blkdatacorrupt=blkinfo->blkhasdatamd5;
     }
     else // data not corrupted, decompresses the block
     {
-        if ((blkinfo->blkcryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo!=ENCRYPT_BLOWFISH))
+        if ((blkinfo->blkcryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo==ENCRYPT_NONE))
         {   msgprintf(MSG_DEBUG1, "this archive has been encrypted, you have to provide a password "
                 "on the command line using option '-c'\n");
             return -1;
@@ -175,8 +431,8 @@ int decompress_block_generic(struct s_blockinfo *blkinfo)
         u64 clearsize;
         if (blkinfo->blkcryptalgo==ENCRYPT_BLOWFISH)
         {
-            if ((bufcrypt=malloc(blkinfo->blkrealsize+8))==NULL)
-            {   errprintf("malloc(%ld) failed: out of memory\n", (long)blkinfo->blkrealsize+8);
+            if ((bufcrypt=blkpool_alloc(blkinfo->blkrealsize+8))==NULL)
+            {   errprintf("blkpool_alloc(%ld) failed: out of memory\n", (long)blkinfo->blkrealsize+8);
                 return -1;
             }
             if ((res=crypto_blowfish(blkinfo->blkarsize, &clearsize, (u8*)blkinfo->blkdata, (u8*)bufcrypt, 
@@ -189,7 +445,27 @@ int decompress_block_generic(struct s_blockinfo *blkinfo)
                     (long)clearsize, (long)blkinfo->blkcompsize);
                 return -1;
             }
-            free(blkinfo->blkdata);
+            blkpool_free(blkinfo->blkdata);
+            blkinfo->blkdata=bufcrypt;
+        }
+        else if (blkinfo->blkcryptalgo==ENCRYPT_AES256GCM)
+        {
+            if ((bufcrypt=blkpool_alloc(blkinfo->blkarsize))==NULL)
+            {   errprintf("blkpool_alloc(%ld) failed: out of memory\n", (long)blkinfo->blkarsize);
+                return -1;
+            }
+            aadlen=block_crypt_aad(blkinfo, aad);
+            if (((res=crypto_aes256gcm(blkinfo->blkarsize, &clearsize, (u8*)blkinfo->blkdata, (u8*)bufcrypt, 
+                blkinfo->blkcryptnonce, aad, aadlen, 0, &ctx->crypt))!=0) || (clearsize!=blkinfo->blkcompsize))
+            {   if (get_stopfillqueue()==false)
+                    errprintf("cannot decrypt the block at blockoffset=%ld: the block has been modified or the password is wrong\n", 
+                        (long)blkinfo->blkoffset);
+                blkpool_free(bufcrypt);
+                memset(bufcomp, 0, blkinfo->blkrealsize);
+                ctx->solidgroup=0; // the next blocks of a solid group cannot be uncompressed either
+                goto decompress_block_generic_done;
+            }
+            blkpool_free(blkinfo->blkdata);
             blkinfo->blkdata=bufcrypt;
         }
         
@@ -210,7 +486,9 @@ int decompress_block_generic(struct s_blockinfo *blkinfo)
                 break;
 #endif // OPTION_LZO_SUPPORT
             case COMPRESS_GZIP:
-                if ((res=uncompress_block_gzip(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
+            case COMPRESS_GZIPDICT:
+                dict=(blkinfo->blkcompalgo==COMPRESS_GZIPDICT)?compdict_get(&dictsize):NULL;
+                if ((res=uncompress_block_gzip(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata, dict, dictsize, &ctx->gzip))!=0)
                 {   errprintf("uncompress_block_gzip()=%d failed: finalsize=%ld and checkorigsize=%ld\n", 
                         res, (long)blkinfo->blkarsize, (long)checkorigsize);
                     memset(bufcomp, 0, blkinfo->blkrealsize);
@@ -227,7 +505,7 @@ int decompress_block_generic(struct s_blockinfo *blkinfo)
                 break;
 #ifdef OPTION_LZMA_SUPPORT
             case COMPRESS_LZMA:
-                if ((res=uncompress_block_lzma(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
+                if ((res=uncompress_block_lzma(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata, &ctx->lzma))!=0)
                 {   errprintf("uncompress_block_lzma()=%d failed: finalsize=%ld and checkorigsize=%ld\n", 
                         res, (long)blkinfo->blkarsize, (long)checkorigsize);
                     memset(bufcomp, 0, blkinfo->blkrealsize);
@@ -235,52 +513,112 @@ int decompress_block_generic(struct s_blockinfo *blkinfo)
                 }
                 break;
 #endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+            case COMPRESS_ZSTD:
+            case COMPRESS_ZSTDDICT:
+                dict=(blkinfo->blkcompalgo==COMPRESS_ZSTDDICT)?compdict_get(&dictsize):NULL;
+                if ((res=uncompress_block_zstd(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata, dict, dictsize, &ctx->zstd))!=0)
+                {   errprintf("uncompress_block_zstd()=%d failed: finalsize=%ld and checkorigsize=%ld\n", 
+                        res, (long)blkinfo->blkarsize, (long)checkorigsize);
+                    memset(bufcomp, 0, blkinfo->blkrealsize);
+                    // TODO: inc(error_counter);
+                }
+                break;
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+            case COMPRESS_LZ4:
+                if ((res=uncompress_block_lz4(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
+                {   errprintf("uncompress_block_lz4()=%d failed: finalsize=%ld and checkorigsize=%ld\n", 
+                        res, (long)blkinfo->blkarsize, (long)checkorigsize);
+                    memset(bufcomp, 0, blkinfo->blkrealsize);
+                    // TODO: inc(error_counter);
+                }
+                break;
+#endif // OPTION_LZ4_SUPPORT
+#ifdef OPTION_LZMA_SUPPORT
+            case COMPRESS_LZMASOLID:
+                if (((res=solidgroup_check_stream(blkinfo, ctx, &newstream))!=0)
+                    || ((res=uncompress_block_lzma_solid(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata, newstream, &ctx->lzma))!=0))
+                {   errprintf("uncompress_block_lzma_solid()=%d failed: finalsize=%ld\n", res, (long)blkinfo->blkarsize);
+                    memset(bufcomp, 0, blkinfo->blkrealsize);
+                    ctx->solidgroup=0; // the next blocks of the group cannot be uncompressed
+                    break;
+                }
+                ctx->solidpos++;
+                break;
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+            case COMPRESS_ZSTDSOLID:
+                if (((res=solidgroup_check_stream(blkinfo, ctx, &newstream))!=0)
+                    || ((res=uncompress_block_zstd_solid(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata, newstream, &ctx->zstd))!=0))
+                {   errprintf("uncompress_block_zstd_solid()=%d failed: finalsize=%ld\n", res, (long)blkinfo->blkarsize);
+                    memset(bufcomp, 0, blkinfo->blkrealsize);
+                    ctx->solidgroup=0; // the next blocks of the group cannot be uncompressed
+                    break;
+                }
+                ctx->solidpos++;
+                break;
+#endif // OPTION_ZSTD_SUPPORT
             default:
                 errprintf("unsupported compression algorithm: %ld\n", (long)blkinfo->blkcompalgo);
                 return -1;
         }
-        free(blkinfo->blkdata); // free old buffer (with compressed data)
+decompress_block_generic_done:
+        blkpool_free(blkinfo->blkdata); // free old buffer (with compressed data)
         blkinfo->blkdata=bufcomp; // pointer to new buffer with uncompressed data
+        
+        // check the md5 of the data here so that the main thread only has to combine the md5 of the blocks
+        if (blkinfo->blkhasdatamd5==true)
+        {   gcry_md_hash_buffer(GCRY_MD_MD5, md5sum, blkinfo->blkdata, blkinfo->blkrealsize);
+            if (memcmp(md5sum, blkinfo->blkdatamd5, 16)!=0)
+            {   if (get_stopfillqueue()==false)
+                    errprintf("the data of the block at blockoffset=%ld do not match their md5sum\n", (long)blkinfo->blkoffset);
+                blkinfo->blkdatacorrupt=true;
+            }
+        }
     }
     
     return 0;
 }
 
-int compression_function(int oper)
+int compression_function(int oper, int worker)
 {
     struct s_blockinfo blkinfo;
+    ccompctx ctx;
     s64 blknum;
     int res;
     
-    while (queue_get_end_of_queue(&g_queue)==false)
+    compctx_init(&ctx);
+    
+    // the loop ends with FSAERR_ENDOFFILE when the queue is empty and no more blocks will be added
+    while ((blknum=queue_get_block_todo(&g_queue, worker, &blkinfo))>0) // block found
     {
-        if ((blknum=queue_get_first_block_todo(&g_queue, &blkinfo))>0) // block found
+        switch (oper)
         {
-            switch (oper)
-            {
-                case COMPTHR_COMPRESS:
-                    res=compress_block_generic(&blkinfo);
-                    break;
-                case COMPTHR_DECOMPRESS:
-                    res=decompress_block_generic(&blkinfo);
-                    break;
-                default:
-                    errprintf("oper is invalid: %d\n", oper);
-                    goto thread_comp_fct_error;
-            }
-            if (res!=0)
-            {   msgprintf(MSG_STACK, "compress_block()=%d failed\n", res);
+            case COMPTHR_COMPRESS:
+                res=compress_block_generic(&blkinfo, &ctx);
+                break;
+            case COMPTHR_DECOMPRESS:
+                res=decompress_block_generic(&blkinfo, &ctx);
+                break;
+            default:
+                errprintf("oper is invalid: %d\n", oper);
                 goto thread_comp_fct_error;
-            }
-            // don't check for errors: it's normal to fail when we terminate after a problem
-            queue_replace_block(&g_queue, blknum, &blkinfo, QITEM_STATUS_DONE);
         }
+        if (res!=0)
+        {   msgprintf(MSG_STACK, "compress_block()=%d failed\n", res);
+            goto thread_comp_fct_error;
+        }
+        // don't check for errors: it's normal to fail when we terminate after a problem
+        queue_replace_block(&g_queue, blknum, &blkinfo, QITEM_STATUS_DONE);
     }
     
+    compctx_destroy(&ctx);
     msgprintf(MSG_DEBUG1, "THREAD-COMP: exit success\n");
     return 0;
     
 thread_comp_fct_error:
+    compctx_destroy(&ctx);
     get_stopfillqueue();
     msgprintf(MSG_DEBUG1, "THREAD-COMP: exit error\n");
     return 0;
@@ -289,7 +627,7 @@ thread_comp_fct_error:
 void *thread_comp_fct(void *args)
 {
     inc_secthreads();
-    compression_function(COMPTHR_COMPRESS);
+    compression_function(COMPTHR_COMPRESS, (int)(long)args);
     dec_secthreads();
     return NULL;
 }
@@ -297,7 +635,7 @@ void *thread_comp_fct(void *args)
 void *thread_decomp_fct(void *args)
 {
     inc_secthreads();
-    compression_function(COMPTHR_DECOMPRESS);
+    compression_function(COMPTHR_DECOMPRESS, (int)(long)args);
     dec_secthreads();
     return NULL;
 }
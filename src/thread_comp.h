@@ -18,8 +18,56 @@
 #ifndef __THREAD_COMP_H__
 #define __THREAD_COMP_H__
 
+#include "comp_gzip.h"
+#include "comp_lzma.h"
+#include "comp_lzo.h"
+#include "comp_zstd.h"
+#include "comp_lz4.h"
+#include "crypto.h"
+
 enum {COMPTHR_COMPRESS=1, COMPTHR_DECOMPRESS=2};
 
+#define FSA_ENTROPY_MINSIZE      16384          // smaller blocks are always compressed (cheap anyway)
+#define FSA_ENTROPY_CHUNKS       32             // number of chunks read in a block to estimate its entropy
+#define FSA_ENTROPY_CHUNKSIZE    128            // size of each of these chunks
+#define FSA_ENTROPY_MAXBITS16    126            // blocks above 7.875 bits per byte (in 1/16 bits) are stored directly
+#define FSA_COMPHINT_SLOTS       1024           // how many files we remember the compressibility of
+#define FSA_COMPHINT_STREAK      4              // stop compressing a file after that many incompressible blocks
+#define FSA_COMPHINT_RECHECK     16             // but still try to compress one block out of that many
+
+struct s_compctx;
+typedef struct s_compctx ccompctx;
+
+struct s_compctx // codec and cipher contexts owned by a compression thread and reused for all the blocks it processes
+{   cgzipctx      gzip;
+#ifdef OPTION_LZMA_SUPPORT
+    clzmactx      lzma;
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_LZO_SUPPORT
+    clzoctx       lzo;
+#endif // OPTION_LZO_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+    czstdctx      zstd;
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+    clz4ctx       lz4;
+#endif // OPTION_LZ4_SUPPORT
+    ccryptctx     crypt;
+    u64           solidgroup; // solid group of the stream which is open in lzma or zstd or 0 (option -g)
+    u32           solidpos; // position of the next block in this stream
+    int           solidalgo; // COMPRESS_LZMASOLID or COMPRESS_ZSTDSOLID: the codec of the stream
+    int           solidlevel; // compression level of the stream
+};
+
+struct s_blockinfo;
+
+u64  comphint_new_file();
+u64  solidgroup_new();
+int compctx_init(ccompctx *ctx);
+int compctx_destroy(ccompctx *ctx);
+int compress_block_generic(struct s_blockinfo *blkinfo, ccompctx *ctx);
+int decompress_block_generic(struct s_blockinfo *blkinfo, ccompctx *ctx);
+
 void *thread_comp_fct(void *args);
 void *thread_decomp_fct(void *args);
 
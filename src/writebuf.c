@@ -27,6 +27,7 @@
 #include "fsarchiver.h"
 #include "writebuf.h"
 #include "common.h"
+#include "checksum.h"
 #include "error.h"
 #include "queue.h"
 #include "dico.h"
@@ -242,7 +243,7 @@ int writebuf_add_block(cwritebuf *wb, struct s_blockinfo *blkinfo, u32 archid, u
         return -1;
     }
     
-    if (blkinfo->blkarsize==0)
+    if ((blkinfo->blkarsize==0) && (blkinfo->blkzero==false))
     {   errprintf("blkinfo->blkarsize=0: block is empty\n");
         return -1;
     }
@@ -252,9 +253,22 @@ int writebuf_add_block(cwritebuf *wb, struct s_blockinfo *blkinfo, u32 archid, u
     dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_REALSIZE, blkinfo->blkrealsize);
     dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_ARSIZE, blkinfo->blkarsize);
     dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_COMPSIZE, blkinfo->blkcompsize);
-    dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_ARCSUM, blkinfo->blkarcsum);
+    if (blkinfo->blkarcsumalgo==CSUMALGO_CRC32C)
+        dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_ARCRC32C, blkinfo->blkarcsum);
+    else
+        dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_ARCSUM, blkinfo->blkarcsum);
     dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_COMPRESSALGO, blkinfo->blkcompalgo);
     dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_ENCRYPTALGO, blkinfo->blkcryptalgo);
+    if ((blkinfo->blkcompalgo==COMPRESS_LZMASOLID) || (blkinfo->blkcompalgo==COMPRESS_ZSTDSOLID))
+    {   dico_add_u64(blkdico, 0, BLOCKHEADITEMKEY_GROUPID, blkinfo->blkgroupid);
+        dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_GROUPPOS, blkinfo->blkgrouppos);
+    }
+    if (blkinfo->blkcryptalgo==ENCRYPT_AES256GCM)
+        dico_add_u64(blkdico, 0, BLOCKHEADITEMKEY_CRYPTNONCE, blkinfo->blkcryptnonce);
+    if (blkinfo->blkhasdatamd5==true)
+        dico_add_data(blkdico, 0, BLOCKHEADITEMKEY_DATAMD5, blkinfo->blkdatamd5, 16);
+    if (blkinfo->blkzero==true)
+        dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_ZEROBLOCK, true);
     
     // write block header
     res=writebuf_add_header(wb, blkdico, FSA_MAGIC_BLKH, archid, fsid);
@@ -264,8 +278,8 @@ int writebuf_add_block(cwritebuf *wb, struct s_blockinfo *blkinfo, u32 archid, u
         return -1;
     }
     
-    // write block data
-    if (writebuf_add_data(wb, blkinfo->blkdata, blkinfo->blkarsize)!=0)
+    // write block data (blocks of zeros have no data)
+    if ((blkinfo->blkzero==false) && (writebuf_add_data(wb, blkinfo->blkdata, blkinfo->blkarsize)!=0))
     {   msgprintf(MSG_STACK, "cannot write data block: writebuf_add_data() failed\n");
         return -1;
     }
@@ -0,0 +1,117 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+
+#include "fsarchiver.h"
+#include "zeroblock.h"
+
+// the x86 kernels are compiled with the target attribute so that the program still runs on any cpu
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#  define FSA_ZEROBLOCK_X86
+#  include <immintrin.h>
+#endif
+
+typedef bool (*czeroblockfct)(char *data, u64 len);
+
+static bool is_block_zero_generic(char *data, u64 len);
+
+// implementation selected by zeroblock_init() for the cpu the program runs on
+static czeroblockfct g_is_block_zero=is_block_zero_generic;
+
+// the bytes which are not in a full chunk are tested one by one
+static bool is_block_zero_tail(char *data, u64 len)
+{
+    u64 pos;
+    
+    for (pos=0; pos < len; pos++)
+        if (data[pos]!=0)
+            return false;
+    return true;
+}
+
+// tests four words at once and stops at the first chunk which is not zero
+static bool is_block_zero_generic(char *data, u64 len)
+{
+    u64 w0, w1, w2, w3;
+    
+    for (; len >= FSA_ZEROBLOCK_CHUNK; len-=FSA_ZEROBLOCK_CHUNK, data+=FSA_ZEROBLOCK_CHUNK)
+    {   memcpy(&w0, data+0, 8);
+        memcpy(&w1, data+8, 8);
+        memcpy(&w2, data+16, 8);
+        memcpy(&w3, data+24, 8);
+        if ((w0|w1|w2|w3)!=0)
+            return false;
+    }
+    return is_block_zero_tail(data, len);
+}
+
+#ifdef FSA_ZEROBLOCK_X86
+
+// tests 64 bytes per iteration with sse2 (always available on x86_64)
+__attribute__((target("sse2")))
+static bool is_block_zero_sse2(char *data, u64 len)
+{
+    const __m128i zero=_mm_setzero_si128();
+    __m128i v;
+    
+    for (; len >= 64; len-=64, data+=64)
+    {   v=_mm_or_si128(_mm_or_si128(_mm_loadu_si128((__m128i*)(data+0)), _mm_loadu_si128((__m128i*)(data+16))),
+            _mm_or_si128(_mm_loadu_si128((__m128i*)(data+32)), _mm_loadu_si128((__m128i*)(data+48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero))!=0xFFFF)
+            return false;
+    }
+    return is_block_zero_generic(data, len);
+}
+
+// tests 128 bytes per iteration with avx2
+__attribute__((target("avx2")))
+static bool is_block_zero_avx2(char *data, u64 len)
+{
+    __m256i v;
+    
+    for (; len >= 128; len-=128, data+=128)
+    {   v=_mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256((__m256i*)(data+0)), _mm256_loadu_si256((__m256i*)(data+32))),
+            _mm256_or_si256(_mm256_loadu_si256((__m256i*)(data+64)), _mm256_loadu_si256((__m256i*)(data+96))));
+        if (_mm256_testz_si256(v, v)==0)
+            return false;
+    }
+    return is_block_zero_generic(data, len);
+}
+
+#endif // FSA_ZEROBLOCK_X86
+
+int zeroblock_init()
+{
+#ifdef FSA_ZEROBLOCK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        g_is_block_zero=is_block_zero_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        g_is_block_zero=is_block_zero_sse2;
+#endif // FSA_ZEROBLOCK_X86
+    return 0;
+}
+
+bool is_block_zero(char *data, u64 len)
+{
+    return g_is_block_zero(data, len);
+}
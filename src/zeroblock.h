@@ -0,0 +1,28 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2012 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __ZEROBLOCK_H__
+#define __ZEROBLOCK_H__
+
+#include "types.h"
+
+#define FSA_ZEROBLOCK_CHUNK      32             // bytes tested per iteration by the generic implementation
+
+int  zeroblock_init();
+bool is_block_zero(char *data, u64 len);
+
+#endif // __ZEROBLOCK_H__